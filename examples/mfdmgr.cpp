@@ -31,6 +31,9 @@ namespace po = boost::program_options;
 #define RET_SHOWSTOPPER         2 ///< Major error (couldn't connect to device, etc.)
 #define RET_BE_MORE_SPECIFIC    3 ///< More info needed (-t auto didn't work, specify a type)
 
+/// Number of seconds before an entry in the --cache file must be probed again
+#define CACHE_TTL           86400
+
 /// Split a string in two at a delimiter
 /**
  * For example "one=two" becomes "one" and "two" and true is returned.  If there
@@ -74,6 +77,9 @@ int main(int iArgC, char *cArgV[])
 		("list,l",
 			"list contents of the address book")
 
+		("info,i",
+			"show version information reported by the device")
+
 		("update,u", po::value<std::string>(),
 			"select an address book entry to change by ID")
 
@@ -92,6 +98,10 @@ int main(int iArgC, char *cArgV[])
 			"username to log in as")
 		("pass,p", po::value<std::string>(),
 			"password")
+		("cache,c", po::value<std::string>(),
+			"remember autodetected device types in this file")
+		("refresh,r",
+			"ignore any cached device type and autodetect again")
 	;
 
 	po::options_description poHidden("Hidden parameters");
@@ -107,7 +117,8 @@ int main(int iArgC, char *cArgV[])
 	poComplete.add(poActions).add(poOptions).add(poHidden);
 	po::variables_map mpArgs;
 
-	std::string host, user, pass, type;
+	std::string host, user, pass, type, cacheFile;
+	bool refresh = false;
 
 	try {
 		po::parsed_options pa = po::parse_command_line(iArgC, cArgV, poComplete);
@@ -167,6 +178,21 @@ int main(int iArgC, char *cArgV[])
 					return RET_BADARGS;
 				}
 				pass = i->value[0];
+			} else if (
+				(i->string_key.compare("c") == 0) ||
+				(i->string_key.compare("cache") == 0)
+			) {
+				if (i->value.size() == 0) {
+					std::cerr << PROGNAME ": --cache (-c) requires a parameter."
+						<< std::endl;
+					return RET_BADARGS;
+				}
+				cacheFile = i->value[0];
+			} else if (
+				(i->string_key.compare("r") == 0) ||
+				(i->string_key.compare("refresh") == 0)
+			) {
+				refresh = true;
 			}
 		}
 
@@ -179,28 +205,21 @@ int main(int iArgC, char *cArgV[])
 
 		// Get the format handler for this file format
 		boost::shared_ptr<mfd::Manager> pManager(mfd::getManager());
+		mfd::DeviceCachePtr pCache;
+		if (!cacheFile.empty()) {
+			pCache.reset(new mfd::DeviceCache(cacheFile, CACHE_TTL));
+			pManager->setCache(pCache);
+		}
 
 		mfd::DeviceTypePtr pDeviceType;
+		mfd::DeviceProbePtr pProbe;
 		if (type.empty()) {
 			// Need to autodetect the file format.
-			mfd::DeviceTypePtr pTestType;
-			int i = 0;
-			while ((pTestType = pManager->getDeviceType(i++))) {
-				mfd::E_CERTAINTY cert = pTestType->isInstance(host);
-				switch (cert) {
-					case mfd::EC_DEFINITELY_NO:
-						// Don't print anything (TODO: Maybe unless verbose?)
-						break;
-					case mfd::EC_DEFINITELY_YES:
-						std::cout << "Device is definitely a " << pTestType->getFriendlyName()
-							<< " [" << pTestType->getDeviceCode() << "]" << std::endl;
-						pDeviceType = pTestType;
-						// Don't bother checking any other formats if we got a 100% match
-						goto finishTesting;
-				}
-			}
-finishTesting:
-			if (!pDeviceType) {
+			pDeviceType = pManager->detect(host, DETECT_TIMEOUT, &pProbe, refresh);
+			if (pDeviceType) {
+				std::cout << "Device is definitely a " << pDeviceType->getFriendlyName()
+					<< " [" << pDeviceType->getDeviceCode() << "]" << std::endl;
+			} else {
 				std::cerr << "Unable to automatically determine the file type.  Use "
 					"the --type option to manually specify the file format." << std::endl;
 				return RET_BE_MORE_SPECIFIC;
@@ -217,8 +236,13 @@ finishTesting:
 
 		assert(pDeviceType != NULL);
 
-		// Connect to the device
-		boost::shared_ptr<mfd::Device> pDevice(pDeviceType->open(host, user, pass));
+		// Connect to the device, reusing the autodetection result if there is one
+		boost::shared_ptr<mfd::Device> pDevice;
+		if (pProbe) {
+			pDevice = pDeviceType->open(pProbe, user, pass);
+		} else {
+			pDevice = pDeviceType->open(host, user, pass);
+		}
 		assert(pDevice);
 
 		int iRet = RET_OK;
@@ -236,26 +260,36 @@ finishTesting:
 					iRet = RET_BADARGS;
 					continue;
 				}
-				const mfd::AddressBook::VC_ENTRYID& entryIds = ab->getEntryIds();
-				for (mfd::AddressBook::VC_ENTRYID::const_iterator i = entryIds.begin();
-					i != entryIds.end(); i++
-				) {
-					std::cout << "id is " << *i << std::endl;
-				}
-				mfd::AddressBook::VC_FIELDLIST allEntries;
-				ab->getEntries(entryIds, allEntries);
-				for (mfd::AddressBook::VC_FIELDLIST::iterator i = allEntries.begin();
-					i != allEntries.end(); i++
+				// Print each page as it arrives, rather than waiting for them all
+				mfd::EntryRange entries(ab);
+				for (mfd::EntryRange::iterator i = entries.begin();
+					i != entries.end(); i++
 				) {
-					mfd::AddressBook::FieldList& fl = *i;
-					for (mfd::AddressBook::FieldList::iterator j = fl.begin();
-						j != fl.end(); j++
-					) {
-						std::cout << j->first << "=" << j->second << "; ";
+					std::cout << "id is " << i.id() << std::endl;
+					for (int f = 0; f < mfd::AddressBook::FieldCount; f++) {
+						mfd::AddressBook::Field field = (mfd::AddressBook::Field)f;
+						if (i->has(field)) {
+							std::cout << ab->getFieldName(field) << "="
+								<< i->get(field) << "; ";
+						}
 					}
 					std::cout << std::endl;
 				}
 
+			} else if (i->string_key.compare("info") == 0) {
+				const mfd::Device::VersionInfo& info = pDevice->getVersionInfo();
+				for (mfd::Device::VersionInfo::const_iterator i = info.begin();
+					i != info.end(); i++
+				) {
+					std::cout << i->first << "=" << i->second << std::endl;
+				}
+				// Save the version info alongside the device type, if we're caching
+				mfd::DeviceCache::Entry entry;
+				if ((pCache) && (pCache->lookup(host, entry)) && (entry.versionInfo != info)) {
+					entry.versionInfo = info;
+					pCache->store(host, entry);
+				}
+
 			} else if (i->string_key.compare("update") == 0) {
 				idABSelected = i->value[0];
 				std::cout << "Selected ID " << idABSelected << " for update" << std::endl;
@@ -21,8 +21,12 @@
 #ifndef _LIBMFD_ADDRESSBOOK_HPP_
 #define _LIBMFD_ADDRESSBOOK_HPP_
 
-//#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 #include <map>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <libmfd/exceptions.hpp>
@@ -30,6 +34,13 @@
 /// Main namespace
 namespace mfd {
 
+class EntryColumns;
+class EntryView;
+class Query;
+
+/// Shared pointer to an EntryView.
+typedef boost::shared_ptr<EntryView> EntryViewPtr;
+
 /// Access to the address book in an MFD.
 /**
  * This class represents the list of addresses in an MFD, often used for
@@ -43,15 +54,229 @@ class AddressBook {
 
 	public:
 
+		/// A property of an address book entry.
+		/**
+		 * Not every device supports every field.  New fields are added before
+		 * FieldCount.
+		 */
 		enum Field {
 			Id,
 			Name,
-			EmailAddress
+			EmailAddress,
+			Index,
+			EntryType,
+			LongName,
+			PhoneticName,
+			TagId,
+			PasswordEncoding,
+			IsDestination,
+			IsSender,
+			AuthName,
+			AuthPassword,
+			Password,
+			PasswordForMailSender,
+			PasswordForRemoteFolder,
+			PasswordPasswordEncoding,
+			EmailParameter,
+			EmailDirectSMTP,
+			FaxNumber,
+			FaxLineType,
+			FaxIsAbroad,
+			FaxParameter,
+			FaxTTINo,
+			FaxLabel1,
+			FaxLabel2,
+			FaxMessageNo,
+			FolderType,
+			FolderServerName,
+			FolderPath,
+			FolderAccountName,
+			FolderPassword,
+			FolderPort,
+			FolderCharacterEncoding,
+			FolderPasswordEncoding,
+			FolderSelect,
+			FolderLogonMode,
+			LdapAccountName,
+			LdapPassword,
+			LdapPasswordEncoding,
+			LdapSelect,
+			SmtpAccountName,
+			SmtpPassword,
+			SmtpPasswordEncoding,
+			SmtpSelect,
+			IfaxAddress,
+			IfaxParameter,
+			IfaxDirectSMTP,
+
+			/// Number of fields, not a field itself.
+			FieldCount
 		};
 		typedef std::string EntryId;
 		typedef std::vector<EntryId> VC_ENTRYID;
 		typedef std::map<Field, std::string> FieldList;
 		typedef std::vector<FieldList> VC_FIELDLIST;
+
+		/// Fields to change in each of a number of entries.
+		typedef std::map<EntryId, FieldList> MP_UPDATE;
+
+		/// List of fields to retrieve.
+		/**
+		 * An empty list retrieves the device's default fields.  The entry ID is
+		 * always retrieved whether or not it is listed.
+		 */
+		typedef std::vector<Field> VC_FIELD;
+
+		/// Compact set of field values for one entry.
+		/**
+		 * This holds the same information as a FieldList, but all the values
+		 * share one buffer and are found by indexing an array with the Field,
+		 * instead of each value being a separate tree node.  This makes a
+		 * large list of entries much smaller and quicker to walk through.
+		 *
+		 * Setting a field that is already set leaves the old value in the buffer,
+		 * so a Record is best filled once and then read.
+		 */
+		class Record {
+
+			public:
+				Record()
+					throw ();
+
+				/// Copy the values out of a FieldList.
+				explicit Record(const FieldList& fl)
+					throw (std::length_error);
+
+				/// Is the field set?
+				bool has(Field field) const
+					throw ()
+				{
+					return (this->present & ((boost::uint64_t)1 << field)) != 0;
+				}
+
+				/// Get a field's value, or an empty string if it is not set.
+				std::string get(Field field) const
+					throw ();
+
+				/// Set a field's value.
+				/**
+				 * @throws std::length_error if the record's values would exceed
+				 *   64kB in total.
+				 */
+				void set(Field field, const char *value, std::string::size_type len)
+					throw (std::length_error);
+
+				/// Set a field's value.
+				void set(Field field, const std::string& value)
+					throw (std::length_error)
+				{
+					this->set(field, value.data(), value.length());
+				}
+
+				/// Remove a field.
+				void erase(Field field)
+					throw ();
+
+				/// Remove all fields.
+				void clear()
+					throw ();
+
+				/// Copy the values into a FieldList.
+				void toFieldList(FieldList& fl) const
+					throw ();
+
+			protected:
+				/// Bit n is set if Field n has a value.
+				boost::uint64_t present;
+
+				/// Start of each field's value in data.
+				boost::uint16_t offset[FieldCount];
+
+				/// Length of each field's value.
+				boost::uint16_t length[FieldCount];
+
+				/// All the values, one after the other.
+				std::string data;
+		};
+		typedef std::vector<Record> VC_RECORD;
+
+		/// Callback given each entry by visitAllEntries() and visitEntries().
+		/**
+		 * Return true to carry on, or false to stop without retrieving any more
+		 * entries.
+		 */
+		typedef boost::function<bool (const EntryId& id, const Record& entry)>
+			FN_VISIT;
+
+		/// Position within a page-by-page scan of the address book.
+		/**
+		 * A default-constructed Cursor starts a new scan.  Pass the same Cursor
+		 * to each call to scanEntryIds() until finished is true.
+		 *
+		 * Apart from finished, the fields are for the use of the device
+		 * implementation and should not be changed by the caller.
+		 */
+		struct Cursor {
+			/// Server-side result set being read, if the device supports them.
+			std::string resultSetId;
+
+			/// Device's ID of the first object returned.
+			std::string firstId;
+
+			/// Device's ID of the last object returned so far.
+			std::string lastId;
+
+			/// Number of results returned so far.
+			int position;
+
+			/// Total number of results, or -1 until the first page is read.
+			int total;
+
+			/// true once the last page has been returned.
+			bool finished;
+
+			Cursor()
+				throw ();
+		};
+
+		/// What happened during a batch of writes.
+		struct BatchStats {
+			/// Number of entries written.
+			unsigned int written;
+
+			/// Number of entries left alone because they already had the values.
+			unsigned int skipped;
+
+			/// Number of entries left alone because they no longer exist.
+			unsigned int missing;
+
+			/// Seconds spent waiting for write access to the address book.
+			double lockWait;
+
+			/// Seconds the address book was locked for, while writing.
+			double lockHeld;
+
+			BatchStats()
+				throw ();
+		};
+
+		/// How well the getEntry() cache is working.
+		struct CacheStats {
+			/// Number of lookups answered from the cache.
+			unsigned long hits;
+
+			/// Number of lookups that had to go to the device.
+			unsigned long misses;
+
+			/// Number of entries dropped to make room for others.
+			unsigned long evictions;
+
+			/// Number of entries in the cache now.
+			unsigned int size;
+
+			CacheStats()
+				throw ();
+		};
 /*
 		AddressBook()
 			throw ();
@@ -59,28 +284,304 @@ class AddressBook {
 		virtual ~AddressBook()
 			throw ();
 */
+		/// Get the name the device uses for a field.
+		/**
+		 * @return The field's name, or NULL if the device doesn't have it.
+		 */
+		virtual const char *getFieldName(Field field) const
+			throw () = 0;
+
 		/// Get a list of entry IDs.
 		/**
-		 * @return Reference to internal list of IDs.  This will remain valid as
-		 *   long as this object is.
+		 * @return The ID of every entry.  This is a copy, as other threads may
+		 *   replace the list held by this object at any time.
+		 */
+		virtual VC_ENTRYID getEntryIds()
+			throw (ECommFailure) = 0;
+
+		/// Get the next page of entry IDs.
+		/**
+		 * Unlike getEntryIds() this returns the list a page at a time, and the
+		 * device keeps its position between pages rather than repeating the
+		 * search each time.
+		 *
+		 * @code
+		 * AddressBook::Cursor cursor;
+		 * AddressBook::VC_ENTRYID page;
+		 * while (!cursor.finished) {
+		 *   ab->scanEntryIds(cursor, page);
+		 *   ...
+		 * }
+		 * @endcode
+		 *
+		 * @param  cursor  Position within the scan, updated on return.
+		 * @param  ids     Replaced with the IDs in the next page.  The device
+		 *                 decides how many are returned.
+		 */
+		virtual void scanEntryIds(Cursor& cursor, VC_ENTRYID& ids)
+			throw (ECommFailure) = 0;
+
+		/// Get details for every entry in the address book.
+		/**
+		 * This is equivalent to passing the result of getEntryIds() to
+		 * getEntries(), but the device may be able to do it in fewer requests.
+		 * Afterwards getEntryIds() will return the IDs of the same entries
+		 * without contacting the device.
+		 *
+		 * @param  fields   Fields to retrieve for each entry.
+		 * @param  results  Entries are appended to this list.
+		 */
+		virtual void getAllEntries(const VC_FIELD& fields, VC_RECORD& results)
+			throw (ECommFailure) = 0;
+
+		/// Get the next page of entries.
+		/**
+		 * This works like scanEntryIds(), but returns the fields of each entry
+		 * as well as the ID.
+		 *
+		 * @param  cursor   Position within the scan, updated on return.
+		 * @param  fields   Fields to retrieve for each entry.
+		 * @param  ids      Replaced with the IDs in the next page.
+		 * @param  results  Replaced with the entries in the next page, in the
+		 *   same order as ids.
 		 */
-		virtual const VC_ENTRYID& getEntryIds()
+		virtual void scanEntries(Cursor& cursor, const VC_FIELD& fields,
+			VC_ENTRYID& ids, VC_RECORD& results)
 			throw (ECommFailure) = 0;
 
+		/// Pass every entry in the address book to a callback.
+		/**
+		 * Each entry is passed on as soon as the page containing it arrives, and
+		 * only one page is held in memory at a time.
+		 *
+		 * @param  fields  Fields to retrieve for each entry.
+		 * @param  visit   Called for each entry, until it returns false.
+		 *
+		 * @return true if every entry was visited, false if visit stopped early.
+		 */
+		bool visitAllEntries(const VC_FIELD& fields, FN_VISIT visit)
+			throw (ECommFailure);
+
+		/// Get details for every entry in the address book, field by field.
+		/**
+		 * This suits reading one or two fields from a large number of entries.
+		 *
+		 * @param  results  Entries are appended to this.  The fields added with
+		 *   EntryColumns::addField() are retrieved, or if none have been added,
+		 *   the device's default fields are added and retrieved.
+		 */
+		virtual void getAllEntries(EntryColumns& results)
+			throw (ECommFailure) = 0;
+
+		/// Get details for every entry in the address book as FieldLists.
+		void getAllEntries(const VC_FIELD& fields, VC_FIELDLIST& results)
+			throw (ECommFailure);
+
+		/// Get the default fields for every entry in the address book.
+		void getAllEntries(VC_FIELDLIST& results)
+			throw (ECommFailure);
+
+		/// Get details for the entries matching a search.
+		/**
+		 * The search is performed by the device, so only the matching entries
+		 * are transferred.
+		 *
+		 * @param  query    Criteria to match.
+		 * @param  results  Matching entries are appended to this list.
+		 */
+		virtual void find(const Query& query, VC_RECORD& results)
+			throw (ECommFailure) = 0;
+
+		/// Get details for the entries matching a search as FieldLists.
+		void find(const Query& query, VC_FIELDLIST& results)
+			throw (ECommFailure);
+
 		/// Get details for a given entry ID.
+		/**
+		 * Entries are cached, so looking up the same entry again is quick but
+		 * may return details up to the cache's TTL old.  Changes made through
+		 * this AddressBook are seen straight away.
+		 *
+		 * @throws ECommFailure if the entry doesn't exist.
+		 */
 		virtual FieldList getEntry(const EntryId& id)
 			throw (ECommFailure) = 0;
 
+		/// Change the size of the getEntry() cache.
+		/**
+		 * @param  maxEntries  Largest number of entries to keep, or 0 to turn
+		 *   the cache off.
+		 * @param  ttl  Seconds an entry is kept for.
+		 */
+		virtual void setEntryCache(unsigned int maxEntries, int ttl)
+			throw () = 0;
+
+		/// Combine getEntry() calls from different threads into one request.
+		/**
+		 * When turned on, a getEntry() that isn't answered from the cache waits
+		 * for up to window milliseconds for calls from other threads, then
+		 * retrieves all the entries at once.  This is off by default, as it
+		 * only helps when lookups arrive in bursts from several threads.
+		 *
+		 * @param  maxEntries  Retrieve the entries as soon as this many are
+		 *   waiting, or 0 to turn batching off.
+		 * @param  window  Milliseconds to wait for other calls.
+		 */
+		virtual void setEntryBatching(unsigned int maxEntries, int window)
+			throw () = 0;
+
+		/// Get the hit and miss counts for the getEntry() cache.
+		virtual CacheStats getEntryCacheStats() const
+			throw () = 0;
+
 		/// Get details for multiple entry IDs in one operation.
-		virtual void getEntries(const VC_ENTRYID& ids, VC_FIELDLIST& results)
+		/**
+		 * @param  ids      Entries to retrieve.
+		 * @param  fields   Fields to retrieve for each entry.  Asking for fewer
+		 *                  fields makes the response smaller and faster.
+		 * @param  results  Entries are appended to this list.
+		 */
+		virtual void getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			VC_RECORD& results)
+			throw (ECommFailure) = 0;
+
+		/// Get details for multiple entry IDs, along with the ID of each.
+		/**
+		 * Entries that don't exist are left out, so the results won't always
+		 * line up with the requested IDs.  Use the returned IDs instead.
+		 *
+		 * @param  ids      Entries to retrieve.
+		 * @param  fields   Fields to retrieve for each entry.
+		 * @param  found    The ID of each entry retrieved is appended to this.
+		 * @param  results  Entries are appended to this list, in the same order
+		 *   as found.
+		 */
+		virtual void getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			VC_ENTRYID& found, VC_RECORD& results)
+			throw (ECommFailure) = 0;
+
+		/// Pass the details for multiple entry IDs to a callback.
+		/**
+		 * The entries are retrieved a batch at a time, with each batch passed on
+		 * before the next is requested.  Entries that don't exist are skipped.
+		 *
+		 * @return true if every entry was visited, false if visit stopped early.
+		 */
+		bool visitEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			FN_VISIT visit)
+			throw (ECommFailure);
+
+		/// Get details for multiple entry IDs in one operation as FieldLists.
+		void getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			VC_FIELDLIST& results)
+			throw (ECommFailure);
+
+		/// Get the default fields for multiple entry IDs in one operation.
+		void getEntries(const VC_ENTRYID& ids, VC_FIELDLIST& results)
+			throw (ECommFailure);
+
+		/// Get details for every entry without copying them.
+		/**
+		 * @param  fields  Fields to retrieve for each entry.
+		 *
+		 * @return A view of the entries, valid until it is destroyed.
+		 */
+		virtual EntryViewPtr viewAllEntries(const VC_FIELD& fields)
+			throw (ECommFailure) = 0;
+
+		/// Get details for multiple entry IDs without copying them.
+		/**
+		 * @return A view of the entries, valid until it is destroyed.
+		 */
+		virtual EntryViewPtr viewEntries(const VC_ENTRYID& ids,
+			const VC_FIELD& fields)
 			throw (ECommFailure) = 0;
 
+		/// Stop sharing memory between existing views and later calls.
+		/**
+		 * Memory from earlier calls is freed now if no view refers to it, or
+		 * otherwise along with the last view that does.  This happens anyway at
+		 * the next call, so it is only needed to free the memory sooner.
+		 */
+		virtual void releaseViews()
+			throw () = 0;
+
 		/// Set details for an entry ID.
+		/**
+		 * Only the fields in update are changed, the rest of the entry is left
+		 * as it is.
+		 */
 		virtual void setEntry(const EntryId& id, const FieldList& update)
 			throw (ECommFailure) = 0;
 
-		/// Add a new entry ID.
-		virtual EntryId createEntry()
+		/// Set details for many entries in one operation.
+		/**
+		 * This is much quicker than calling setEntry() for each entry, as the
+		 * device only has to be locked for writing once.
+		 *
+		 * @param  updates  Fields to change in each entry.  As with setEntry(),
+		 *   fields not listed are left alone.
+		 *
+		 * @throws ECommFailure if any update fails.  Updates before it will
+		 *         have been made and those after it will not.
+		 */
+		void applyBatch(const MP_UPDATE& updates)
+			throw (ECommFailure);
+
+		/// Set details for many entries, reporting how long it took.
+		/**
+		 * Only written, lockWait and lockHeld are filled in, as the updates are
+		 * applied without checking them first.  See WriteScheduler for that.
+		 */
+		virtual void applyBatch(const MP_UPDATE& updates, BatchStats& stats)
+			throw (ECommFailure) = 0;
+
+		/// Add a new entry.
+		/**
+		 * @return The ID of the new entry.
+		 */
+		EntryId createEntry(const FieldList& fields = FieldList())
+			throw (ECommFailure);
+
+		/// Add new entries in one operation.
+		/**
+		 * @param  entries  Fields for each new entry.
+		 * @param  ids      The ID of each new entry is appended here, in the
+		 *   same order as entries.
+		 *
+		 * @throws ECommFailure if the entries couldn't be created, or the
+		 *   device didn't return a valid ID for every one of them.
+		 */
+		virtual void createEntries(const VC_FIELDLIST& entries, VC_ENTRYID& ids)
+			throw (ECommFailure) = 0;
+
+		/// Remove an entry.
+		void deleteEntry(const EntryId& id)
+			throw (ECommFailure);
+
+		/// Remove entries in one operation.
+		virtual void deleteEntries(const VC_ENTRYID& ids)
+			throw (ECommFailure) = 0;
+
+		/// Remove, change and add entries while locked for writing only once.
+		/**
+		 * This does the same as deleteEntries(), applyBatch() and
+		 * createEntries() in that order, but the device only has to be locked
+		 * for writing once rather than three times.
+		 *
+		 * @param  deletes  Entries to remove.
+		 * @param  updates  Fields to change in existing entries.
+		 * @param  creates  Fields for each new entry.
+		 * @param  ids      The ID of each new entry is appended here, in the
+		 *   same order as creates.
+		 * @param  stats    As for applyBatch().
+		 *
+		 * @throws ECommFailure if any step fails.  Steps before it will have
+		 *         been done and those after it will not.
+		 */
+		virtual void applyChanges(const VC_ENTRYID& deletes,
+			const MP_UPDATE& updates, const VC_FIELDLIST& creates,
+			VC_ENTRYID& ids, BatchStats& stats)
 			throw (ECommFailure) = 0;
 
 };
@@ -0,0 +1,131 @@
+/**
+ * @file   cache.hpp
+ * @brief  DeviceCache class, used to remember autodetection results between
+ *         runs.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_CACHE_HPP_
+#define _LIBMFD_CACHE_HPP_
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include <libmfd/device.hpp>
+
+namespace mfd {
+
+/// On-disk cache of device types and versions, keyed by hostname.
+/**
+ * Detecting a device and asking it for its version costs several network
+ * round trips, but the answers rarely change.  This class stores them in a
+ * file so that later runs can skip the probes until the entry expires.
+ *
+ * The file may be shared by any number of processes at once.  Updates are
+ * serialised with a lock file and written to a temporary file which is then
+ * renamed over the original, so readers never see a partially written cache.
+ */
+class DeviceCache {
+
+	public:
+		/// Cached details for a single host.
+		struct Entry {
+			/// Device code of the matching DeviceType, e.g. "ricoh-aficio".
+			std::string deviceCode;
+
+			/// Time the device was last probed.
+			time_t updated;
+
+			/// Type-specific details from DeviceProbe::details.
+			std::map<std::string, std::string> details;
+
+			/// Version information from Device::getVersionInfo(), if it has
+			/// been retrieved, otherwise empty.
+			Device::VersionInfo versionInfo;
+		};
+
+	private:
+		/// Filename of the cache.
+		std::string filename;
+
+		/// Number of seconds before an entry expires.
+		int ttl;
+
+		/// Map of hostnames to cache entries.
+		typedef std::map<std::string, Entry> MP_ENTRY;
+
+	public:
+		/// Open a cache file.
+		/**
+		 * @param  filename  Path of the cache file.  It will be created the first
+		 *                   time an entry is stored.
+		 * @param  ttl       Number of seconds an entry remains valid for.
+		 */
+		DeviceCache(const std::string& filename, int ttl)
+			throw ();
+
+		~DeviceCache()
+			throw ();
+
+		/// Look up a host.
+		/**
+		 * @param  hostname  Hostname to look up.
+		 * @param  entry     On success, set to the cached details.
+		 * @return true if an entry was found and has not yet expired.
+		 */
+		bool lookup(const std::string& hostname, Entry& entry) const
+			throw ();
+
+		/// Add or replace the entry for a host.
+		/**
+		 * @param  hostname  Hostname to store the entry against.
+		 * @param  entry     Details to store.  entry.updated is saved as-is.
+		 * @return true on success, false if the cache file couldn't be written.
+		 *         A failure here only means the next run will probe again.
+		 */
+		bool store(const std::string& hostname, const Entry& entry)
+			throw ();
+
+		/// Remove the entry for a host, e.g. after it has been replaced.
+		/**
+		 * @return true on success, false if the cache file couldn't be written.
+		 */
+		bool invalidate(const std::string& hostname)
+			throw ();
+
+	protected:
+		/// Read every entry from the cache file.
+		void load(MP_ENTRY& entries) const
+			throw ();
+
+		/// Apply a change to the cache file while holding the lock.
+		/**
+		 * @param  hostname  Host to change.
+		 * @param  entry     New entry, or NULL to remove the host.
+		 */
+		bool update(const std::string& hostname, const Entry *entry)
+			throw ();
+};
+
+/// Shared pointer to a DeviceCache.
+typedef boost::shared_ptr<DeviceCache> DeviceCachePtr;
+
+} // namespace mfd
+
+#endif // _LIBMFD_CACHE_HPP_
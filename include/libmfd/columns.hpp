@@ -0,0 +1,205 @@
+/**
+ * @file   columns.hpp
+ * @brief  EntryColumns class, holding address book entries field by field.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_COLUMNS_HPP_
+#define _LIBMFD_COLUMNS_HPP_
+
+#include <boost/cstdint.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Address book entries stored one field at a time.
+/**
+ * Each field is kept as a column: every entry's value for that field stored
+ * one after the other in a single buffer.  Walking through one field of many
+ * entries, such as collecting every e-mail address, then reads memory in
+ * order and needs no allocations.
+ *
+ * Choose the fields with addField() before filling the columns:
+ *
+ * @code
+ * EntryColumns cols;
+ * cols.addField(AddressBook::EmailAddress);
+ * ab->getAllEntries(cols);
+ * const EntryColumns::Column& email = cols.column(AddressBook::EmailAddress);
+ * for (unsigned int i = 0; i < email.size(); i++) {
+ *   std::cout << cols.ids().get(i) << ": " << email.get(i) << "\n";
+ * }
+ * @endcode
+ */
+class EntryColumns {
+
+	public:
+		/// One field's value for every entry.
+		/**
+		 * Entries that don't have the field hold an empty value.
+		 */
+		class Column {
+
+			public:
+				Column()
+					throw ();
+
+				/// Number of values in the column.
+				unsigned int size() const
+					throw ()
+				{
+					return this->ends.size();
+				}
+
+				/// Pointer to a value, which is not NUL-terminated.
+				const char *data(unsigned int row) const
+					throw ()
+				{
+					return this->arena.data() + this->start(row);
+				}
+
+				/// Length of a value in bytes.
+				unsigned int length(unsigned int row) const
+					throw ()
+				{
+					return this->ends[row] - this->start(row);
+				}
+
+				/// Copy of a value.
+				std::string get(unsigned int row) const
+					throw ();
+
+				/// Add a value after the last one.
+				void append(const char *value, unsigned int len)
+					throw ();
+
+				/// Allocate space for more values.
+				void reserve(unsigned int rows, unsigned int bytes)
+					throw ();
+
+				/// Remove all values.
+				void clear()
+					throw ();
+
+			protected:
+				/// All the values, one after the other.
+				std::string arena;
+
+				/// Offset in arena where each value ends.
+				std::vector<boost::uint32_t> ends;
+
+				/// Offset in arena where a value starts.
+				unsigned int start(unsigned int row) const
+					throw ()
+				{
+					return row ? this->ends[row - 1] : 0;
+				}
+
+		};
+
+		EntryColumns()
+			throw ();
+
+		/// Store this field for each entry.
+		/**
+		 * Fields added after rows have been stored will be empty for those rows.
+		 */
+		void addField(AddressBook::Field field)
+			throw ();
+
+		/// Is this field being stored?
+		bool hasField(AddressBook::Field field) const
+			throw ()
+		{
+			return this->columnIndex[field] >= 0;
+		}
+
+		/// List of fields being stored, in the order they were added.
+		const AddressBook::VC_FIELD& getFields() const
+			throw ()
+		{
+			return this->fields;
+		}
+
+		/// Values of a field.
+		/**
+		 * @pre hasField(field) is true.
+		 */
+		const Column& column(AddressBook::Field field) const
+			throw ()
+		{
+			return this->columns[this->columnIndex[field]];
+		}
+
+		/// Entry ID of each row.
+		const Column& ids() const
+			throw ()
+		{
+			return this->idColumn;
+		}
+
+		/// Number of entries stored.
+		unsigned int size() const
+			throw ()
+		{
+			return this->idColumn.size();
+		}
+
+		/// Allocate space for more entries.
+		void reserve(unsigned int rows)
+			throw ();
+
+		/// Remove all entries, but keep the list of fields.
+		void clear()
+			throw ();
+
+		/// Start adding a new entry.
+		void beginRow(const std::string& id)
+			throw ();
+
+		/// Set a field in the entry being added.
+		/**
+		 * Fields that aren't being stored are ignored.  The value is not copied
+		 * until endRow(), so it must remain valid until then.
+		 */
+		void set(AddressBook::Field field, const std::string& value)
+			throw ();
+
+		/// Finish adding the entry started by beginRow().
+		void endRow()
+			throw ();
+
+	protected:
+		AddressBook::VC_FIELD fields;  ///< Fields stored, in column order
+		Column idColumn;               ///< Entry IDs
+		std::vector<Column> columns;   ///< One column per field
+
+		/// Index into columns for each field, or -1 if it isn't stored.
+		int columnIndex[AddressBook::FieldCount];
+
+		/// Values for the row being added, indexed like columns.
+		std::vector< std::pair<const char *, unsigned int> > pending;
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_COLUMNS_HPP_
@@ -24,6 +24,7 @@
 #include <boost/shared_ptr.hpp>
 #include <exception>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <vector>
 
@@ -32,6 +33,20 @@
 /// Main namespace
 namespace mfd {
 
+/// Network connection statistics for a Device.
+struct ConnectionStats {
+	/// Number of requests sent to the device.
+	unsigned long requests;
+
+	/// Number of TCP connections opened to the device.  Any requests above
+	/// this number were sent over an existing (kept-alive) connection.
+	unsigned long connects;
+
+	/// Number of requests that had to be resent because the device closed a
+	/// kept-alive connection.
+	unsigned long reconnects;
+};
+
 /// Primary interface to a device.
 /**
  * This class represents a multi-function device (e.g. a photocopier.)  Its
@@ -44,6 +59,9 @@ namespace mfd {
 class Device {
 
 	public:
+		/// List of name=value pairs describing the device firmware/software.
+		typedef std::map<std::string, std::string> VersionInfo;
+
 /*
 		Device()
 			throw ();
@@ -55,6 +73,20 @@ class Device {
 		virtual AddressBookPtr getAddressBook()
 			throw () = 0;
 
+		/// Get version information reported by the device.
+		/**
+		 * This is retrieved from the device the first time it is requested.
+		 *
+		 * @return Reference to an internal list of properties.  This will remain
+		 *   valid as long as this object is.
+		 */
+		virtual const VersionInfo& getVersionInfo()
+			throw (ECommFailure) = 0;
+
+		/// Get statistics about the network connection to this device.
+		virtual ConnectionStats getConnectionStats() const
+			throw () = 0;
+
 };
 
 /// Shared pointer to an Device.
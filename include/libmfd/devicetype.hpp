@@ -22,8 +22,10 @@
 #ifndef _LIBMFD_DEVICETYPE_HPP_
 #define _LIBMFD_DEVICETYPE_HPP_
 
+#include <string>
 #include <vector>
 #include <map>
+#include <boost/shared_ptr.hpp>
 
 #include <libmfd/device.hpp>
 #include <libmfd/exceptions.hpp>
@@ -39,6 +41,47 @@ enum E_CERTAINTY {
 	EC_DEFINITELY_YES,
 };
 
+/// Result of probing a host for a particular device type.
+/**
+ * This is returned by DeviceType::probe() and holds whatever was learned
+ * while checking the device, such as an already-open connection, so that
+ * DeviceType::open() doesn't have to repeat the same requests.
+ *
+ * Device types may derive from this class to store their own details.
+ */
+class DeviceProbe {
+
+	public:
+		/// Host that was probed.
+		std::string hostname;
+
+		/// Result of the probe.
+		E_CERTAINTY certainty;
+
+		/// Type-specific details learned by the probe, e.g. protocol version.
+		/**
+		 * These are saved by DeviceCache, so a probe recreated from the cache
+		 * carries the same details even though no connection was made.
+		 */
+		std::map<std::string, std::string> details;
+
+		/// Version information for Device::getVersionInfo(), if known.
+		/**
+		 * If this is empty the Device will ask the device for it.
+		 */
+		Device::VersionInfo versionInfo;
+
+		DeviceProbe(const std::string& hostname, E_CERTAINTY certainty)
+			throw ();
+
+		virtual ~DeviceProbe()
+			throw ();
+
+};
+
+/// Shared pointer to a DeviceProbe.
+typedef boost::shared_ptr<DeviceProbe> DeviceProbePtr;
+
 /// Interface to a particular device.
 class DeviceType {
 
@@ -63,11 +106,29 @@ class DeviceType {
 		/// Check a host to see if it's in a supported device.
 		/**
 		 * @param  hostname  The hostname of the device to check.
-		 * @param  username  Username with sufficient access.
-		 * @param  password  Plain-text password.
+		 * @param  timeout   Give up and return EC_DEFINITELY_NO if the device
+		 *                   hasn't responded after this many seconds.  0 means
+		 *                   use the system's default network timeouts.
 		 * @return A single confidence value from \ref E_CERTAINTY.
 		 */
-		virtual E_CERTAINTY isInstance(const std::string& hostname) const
+		virtual E_CERTAINTY isInstance(const std::string& hostname,
+			int timeout = 0) const
+			throw (std::ios::failure) = 0;
+
+		/// Check a host to see if it's in a supported device, and keep the result.
+		/**
+		 * This is the same as isInstance(), except that the details gathered
+		 * along the way are returned so they can be passed to open().
+		 *
+		 * @param  hostname  The hostname of the device to check.
+		 * @param  timeout   Give up if the device hasn't responded after this
+		 *                   many seconds.  0 means use the system's default
+		 *                   network timeouts.
+		 * @return The probe result.  Its certainty field holds the same value
+		 *         isInstance() would have returned.
+		 */
+		virtual DeviceProbePtr probe(const std::string& hostname,
+			int timeout = 0) const
 			throw (std::ios::failure) = 0;
 
 		/// Open a device.
@@ -84,6 +145,21 @@ class DeviceType {
 			const std::string& username, const std::string& password) const
 			throw (ECommFailure) = 0;
 
+		/// Open a device that has already been probed.
+		/**
+		 * @param  probe     Result of an earlier call to probe() on this
+		 *                   DeviceType.  Any connection it holds is handed over to
+		 *                   the new Device, so each probe should only be opened
+		 *                   once.
+		 * @param  username  Username with sufficient access.
+		 * @param  password  Plain-text password.
+		 * @return A pointer to an instance of the Device class.
+		 * @throws ECommFailure if probe is NULL.
+		 */
+		virtual DevicePtr open(DeviceProbePtr probe,
+			const std::string& username, const std::string& password) const
+			throw (ECommFailure) = 0;
+
 };
 
 /// Shared pointer to an DeviceType.
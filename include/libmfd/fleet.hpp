@@ -0,0 +1,158 @@
+/**
+ * @file   fleet.hpp
+ * @brief  FleetManager class, used to run the same operation across many
+ *         devices at once.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_FLEET_HPP_
+#define _LIBMFD_FLEET_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <libmfd/addressbook.hpp>
+#include <libmfd/manager.hpp>
+
+namespace mfd {
+
+struct FleetQueue;
+
+/// List of hostnames making up a fleet.
+typedef std::vector<std::string> VC_HOSTNAME;
+
+/// Operation to perform on each device in a fleet.
+enum FleetOperation {
+	/// Retrieve every entry in the address book.
+	FleetList,
+	/// Retrieve a single address book entry.
+	FleetGet,
+	/// Change fields in an existing address book entry.
+	FleetSet,
+	/// Add a new address book entry and populate its fields.
+	FleetCreate,
+};
+
+/// Description of the work to perform on every device in a fleet.
+struct FleetJob {
+	/// Operation to perform.
+	FleetOperation operation;
+
+	/// Device code (e.g. "ricoh-aficio"), or empty to autodetect each host.
+	std::string deviceCode;
+
+	/// Username to log in to each device with.
+	std::string username;
+
+	/// Plain-text password for each device.
+	std::string password;
+
+	/// Entry to act on, for FleetGet and FleetSet.
+	AddressBook::EntryId id;
+
+	/// Field values to write, for FleetSet and FleetCreate.
+	AddressBook::FieldList fields;
+};
+
+/// Outcome of a FleetJob on a single device.
+struct FleetResult {
+	/// Host this result belongs to.
+	std::string hostname;
+
+	/// true if the operation completed, false if error is set instead.
+	bool success;
+
+	/// Reason for the failure when success is false.
+	std::string error;
+
+	/// Entries retrieved by FleetList and FleetGet.
+	AddressBook::VC_RECORD entries;
+
+	/// ID of the entry added by FleetCreate.
+	AddressBook::EntryId id;
+};
+
+/// Vector of FleetResult structures, one per host.
+typedef std::vector<FleetResult> VC_FLEETRESULT;
+
+/// Run an operation across many devices in parallel.
+/**
+ * Talking to a device is dominated by network latency rather than CPU time,
+ * so this class connects to a number of devices at once, each on its own
+ * worker thread.  Each thread opens its own Device instance, so the
+ * one-call-at-a-time restriction on Device is still honoured.
+ *
+ * A failure on one host (unreachable, bad password, etc.) is recorded in that
+ * host's FleetResult and does not affect the other hosts.
+ */
+class FleetManager {
+	private:
+		/// Manager used to look up and autodetect device types.
+		ManagerPtr manager;
+
+		/// Maximum number of devices to talk to at the same time.
+		int threads;
+
+	public:
+		/// Create a new fleet manager.
+		/**
+		 * @param  manager  Manager instance from getManager().
+		 * @param  threads  Maximum number of devices to contact at once.
+		 */
+		FleetManager(ManagerPtr manager, int threads)
+			throw ();
+
+		~FleetManager()
+			throw ();
+
+		/// Run a job on every host and wait for them all to finish.
+		/**
+		 * If the system won't allow as many threads as were asked for, fewer
+		 * hosts are contacted at once, down to one at a time on the calling
+		 * thread.
+		 *
+		 * @param  hosts    List of hostnames or IP addresses.
+		 * @param  job      Operation to perform on each host.
+		 * @param  results  On return, one entry per host in the same order as
+		 *                  hosts.
+		 */
+		void run(const VC_HOSTNAME& hosts, const FleetJob& job,
+			VC_FLEETRESULT& results)
+			throw ();
+
+	protected:
+		/// Thread entry point, processes hosts until the queue is empty.
+		void worker(FleetQueue *queue)
+			throw ();
+
+		/// Run a job on a single host, storing the outcome in result.
+		void runHost(const std::string& hostname, const FleetJob& job,
+			FleetResult& result)
+			throw ();
+
+		/// Open a device, autodetecting its type if the job doesn't specify one.
+		DevicePtr openDevice(const std::string& hostname, const FleetJob& job)
+			throw (ECommFailure);
+};
+
+/// Shared pointer to a FleetManager.
+typedef boost::shared_ptr<FleetManager> FleetManagerPtr;
+
+} // namespace mfd
+
+#endif // _LIBMFD_FLEET_HPP_
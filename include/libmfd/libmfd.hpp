@@ -46,6 +46,10 @@ connecting produces an instance of the Device class.
 The Device class is used to directly manipulate the MFD, such as by editing the
 internal address book.
 
+To perform the same operation on many devices at once, pass the Manager to a
+FleetManager, which talks to multiple devices in parallel and returns a
+FleetResult for each one.
+
 \section example Examples
 
 The libmfd distribution comes with example code in the form of the
@@ -57,8 +61,17 @@ full functionality of the library.
 }
 
 // These are all in the mfd namespace
+#include <libmfd/cache.hpp>
 #include <libmfd/device.hpp>
 #include <libmfd/devicetype.hpp>
 #include <libmfd/manager.hpp>
+#include <libmfd/fleet.hpp>
+#include <libmfd/query.hpp>
+#include <libmfd/columns.hpp>
+#include <libmfd/view.hpp>
+#include <libmfd/range.hpp>
+#include <libmfd/replica.hpp>
+#include <libmfd/sync.hpp>
+#include <libmfd/scheduler.hpp>
 
 #endif // _LIBMFD_HPP_
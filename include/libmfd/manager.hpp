@@ -23,10 +23,14 @@
 
 #include <vector>
 #include <boost/shared_ptr.hpp>
+#include <libmfd/cache.hpp>
 #include <libmfd/devicetype.hpp>
 
 namespace mfd {
 
+/// Suggested number of seconds to wait for a device to respond to detect()
+#define DETECT_TIMEOUT         10
+
 class Manager;
 
 /// Shared pointer to a Manager.
@@ -59,6 +63,9 @@ class Manager {
 		/// List of available archive types.
 		VC_DEVICETYPE vcTypes;
 
+		/// Cache of earlier detect() results, may be empty.
+		DeviceCachePtr cache;
+
 		Manager()
 			throw ();
 
@@ -90,6 +97,39 @@ class Manager {
 		 */
 		DeviceTypePtr getDeviceTypeByCode(const std::string& strCode)
 			throw ();
+
+		/// Use a cache to remember detect() results.
+		/**
+		 * @param  cache  Cache to use, or an empty pointer to disable caching.
+		 */
+		void setCache(DeviceCachePtr cache)
+			throw ();
+
+		/// Autodetect the type of a device.
+		/**
+		 * All the supported device types are probed at the same time, so
+		 * detection takes about as long as the slowest single probe rather than
+		 * the sum of them all.  As soon as one device type reports
+		 * EC_DEFINITELY_YES the remaining probes are abandoned.
+		 *
+		 * If a cache has been set with setCache() and it holds an unexpired entry
+		 * for the host, the device is not contacted at all.  Otherwise the result
+		 * of a successful probe is saved to the cache.
+		 *
+		 * @param  hostname  The hostname of the device to check.
+		 * @param  timeout   Maximum number of seconds to wait for an answer.  Each
+		 *                   probe is also given this as its network timeout.
+		 * @param  probe     Optional.  On return, the result of the successful
+		 *                   probe, which can be passed to DeviceType::open() to
+		 *                   avoid contacting the device again.
+		 * @param  refresh   true to ignore any cached entry and probe the device
+		 *                   again, e.g. after it has been replaced.
+		 * @return A shared pointer to the matching DeviceType, or an empty
+		 *         pointer if no type matched before the timeout expired.
+		 */
+		DeviceTypePtr detect(const std::string& hostname, int timeout,
+			DeviceProbePtr *probe = NULL, bool refresh = false)
+			throw ();
 };
 
 } // namespace mfd
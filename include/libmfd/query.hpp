@@ -0,0 +1,151 @@
+/**
+ * @file   query.hpp
+ * @brief  Query class, used to search an address book on the device.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_QUERY_HPP_
+#define _LIBMFD_QUERY_HPP_
+
+#include <string>
+#include <vector>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Search criteria for AddressBook::find().
+/**
+ * The criteria are sent to the device, so only the matching entries are
+ * transferred.  Functions return a reference to the Query so calls can be
+ * chained:
+ *
+ * @code
+ * AddressBook::VC_FIELDLIST results;
+ * ab->find(Query().where(AddressBook::EmailAddress, Query::Equal,
+ *   "someone@example.com"), results);
+ * @endcode
+ *
+ * An entry matches if it satisfies every where() term and, if any
+ * orWhere() terms have been given, at least one of those as well.  A Query
+ * with no terms matches every entry.
+ *
+ * The device can also sort the results and return only the first few, for
+ * example to show the first page of a list:
+ *
+ * @code
+ * ab->find(Query().orderBy(AddressBook::Index).limit(20), results);
+ * @endcode
+ */
+class Query {
+
+	public:
+		/// Comparison between a field and a value.
+		enum Operator {
+			Equal,
+			NotEqual,
+			Less,
+			LessEqual,
+			Greater,
+			GreaterEqual,
+			/// Field contains the value anywhere within it.
+			Contains,
+			/// Field begins with the value.
+			StartsWith,
+			/// Field is between value and value2, inclusive.
+			Between,
+		};
+
+		/// A single condition.
+		struct Term {
+			AddressBook::Field field;
+			Operator op;
+			std::string value;
+			/// Upper bound for Between, otherwise unused.
+			std::string value2;
+		};
+
+		/// List of conditions.
+		typedef std::vector<Term> VC_TERM;
+
+		/// A sort key.
+		struct Order {
+			AddressBook::Field field;
+			bool descending;
+		};
+
+		/// List of sort keys, most significant first.
+		typedef std::vector<Order> VC_ORDER;
+
+		/// Terms that must all match.
+		VC_TERM allOf;
+
+		/// Terms of which at least one must match, ignored if empty.
+		VC_TERM anyOf;
+
+		/// Order to return results in, or empty for the device's default.
+		VC_ORDER sortOrder;
+
+		/// Maximum number of results to return, or 0 for no limit.
+		unsigned int maxResults;
+
+		/// Fields to return for each result, or empty for the default fields.
+		AddressBook::VC_FIELD fields;
+
+		Query()
+			throw ();
+
+		/// Add a condition that must match.
+		Query& where(AddressBook::Field field, Operator op,
+			const std::string& value)
+			throw ();
+
+		/// Add a range condition that must match.
+		Query& whereBetween(AddressBook::Field field, const std::string& low,
+			const std::string& high)
+			throw ();
+
+		/// Add an alternative condition, of which at least one must match.
+		Query& orWhere(AddressBook::Field field, Operator op,
+			const std::string& value)
+			throw ();
+
+		/// Sort the results by a field.
+		/**
+		 * Call again to add further keys, which are used when earlier keys are
+		 * equal.
+		 */
+		Query& orderBy(AddressBook::Field field, bool descending = false)
+			throw ();
+
+		/// Return this field for each result.
+		/**
+		 * Call once for each field needed.  If never called, the device's
+		 * default fields are returned.
+		 */
+		Query& select(AddressBook::Field field)
+			throw ();
+
+		/// Return no more than this many results.
+		Query& limit(unsigned int count)
+			throw ();
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_QUERY_HPP_
@@ -0,0 +1,137 @@
+/**
+ * @file   range.hpp
+ * @brief  EntryRange class, for iterating through an address book lazily.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_RANGE_HPP_
+#define _LIBMFD_RANGE_HPP_
+
+#include <iterator>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Every entry in an address book, retrieved a page at a time as needed.
+/**
+ * Nothing is retrieved until the first entry is needed, and the next page is
+ * only requested once the previous one has been used, so only one page is
+ * held in memory at once.
+ *
+ * @code
+ * EntryRange range(ab, fields);
+ * for (EntryRange::iterator i = range.begin(); i != range.end(); i++) {
+ *   std::cout << i.id() << ": " << i->get(AddressBook::Name) << "\n";
+ * }
+ * @endcode
+ *
+ * Like any input range, it can only be walked through once.
+ */
+class EntryRange {
+
+	public:
+		/// Input iterator over the entries.
+		class iterator: public std::iterator<std::input_iterator_tag,
+			const AddressBook::Record>
+		{
+			public:
+				/// Create an end iterator.
+				iterator()
+					throw ();
+
+				/// ID of the current entry.
+				const AddressBook::EntryId& id() const
+					throw ();
+
+				const AddressBook::Record& operator * () const
+					throw ();
+
+				const AddressBook::Record *operator -> () const
+					throw ();
+
+				/// Move to the next entry, retrieving the next page if needed.
+				iterator& operator ++ ()
+					throw (ECommFailure);
+
+				/// Move to the next entry.
+				/**
+				 * As with any input iterator, the old value is not available
+				 * afterwards.
+				 */
+				void operator ++ (int)
+					throw (ECommFailure);
+
+				bool operator == (const iterator& other) const
+					throw ();
+
+				bool operator != (const iterator& other) const
+					throw ();
+
+			protected:
+				EntryRange *range;  ///< NULL at the end
+
+				iterator(EntryRange *range)
+					throw ();
+
+				friend class EntryRange;
+		};
+
+		/**
+		 * @param  ab      Address book to read.
+		 * @param  fields  Fields to retrieve for each entry.
+		 */
+		EntryRange(AddressBookPtr ab,
+			const AddressBook::VC_FIELD& fields = AddressBook::VC_FIELD())
+			throw ();
+
+		/// Get an iterator at the first entry, retrieving the first page.
+		iterator begin()
+			throw (ECommFailure);
+
+		/// Get an iterator past the last entry.
+		iterator end()
+			throw ();
+
+	protected:
+		AddressBookPtr ab;
+		AddressBook::VC_FIELD fields;
+		AddressBook::Cursor cursor;
+		AddressBook::VC_ENTRYID ids;  ///< IDs in the current page
+		AddressBook::VC_RECORD page;  ///< Entries in the current page
+		unsigned int pos;             ///< Current entry in the page
+		bool started;                 ///< true once begin() has been called
+
+		/// Move to the next entry.
+		/**
+		 * @return false if there are no more entries.
+		 */
+		bool advance()
+			throw (ECommFailure);
+
+		/// Retrieve pages until one has an entry in it.
+		/**
+		 * @return false if there are no more entries.
+		 */
+		bool fetch()
+			throw (ECommFailure);
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_RANGE_HPP_
@@ -0,0 +1,208 @@
+/**
+ * @file   replica.hpp
+ * @brief  Replica class, keeping a copy of an address book in memory.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_REPLICA_HPP_
+#define _LIBMFD_REPLICA_HPP_
+
+#include <map>
+#include <string>
+#include <time.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Copy of an address book, held in memory and refreshed from the device.
+/**
+ * Reading from the replica never contacts the device, so it is very quick but
+ * may be out of date by up to the time since the last refresh.
+ *
+ * A refresh only lists the ID and index of every entry, then retrieves the
+ * entries which are new or whose index has changed, and drops those which
+ * have gone.  The index is the entry's registration number, which stays the
+ * same when the entry is edited, so in practice a refresh only picks up
+ * added and deleted entries.  Edits are only picked up by a full reload,
+ * which is done every five minutes by default (see setReloadInterval().)
+ *
+ * @note Multithreading: The read functions may be called from any number of
+ *       threads, including while a refresh is running.  The replica must be
+ *       the only user of the AddressBook while it exists.
+ */
+class Replica {
+
+	public:
+		/**
+		 * @param  ab      Address book to copy.
+		 * @param  fields  Fields to keep for each entry.  Index is added if it
+		 *   isn't already listed, as refreshes depend on it.
+		 *
+		 * @note Nothing is retrieved until the first refresh().
+		 */
+		Replica(AddressBookPtr ab,
+			const AddressBook::VC_FIELD& fields = AddressBook::VC_FIELD())
+			throw ();
+
+		/// Stops the background refresh if it is running.
+		~Replica()
+			throw ();
+
+		/// Retrieve the whole address book again.
+		void load()
+			throw (ECommFailure);
+
+		/// Bring the replica up to date.
+		/**
+		 * This loads the whole address book the first time, and when the reload
+		 * interval has passed.  Otherwise only changed entries are retrieved.
+		 */
+		void refresh()
+			throw (ECommFailure);
+
+		/// Refresh the replica if it is older than the given age.
+		/**
+		 * @param  maxAge  Maximum acceptable age, in seconds.
+		 * @return true if a refresh was done.
+		 */
+		bool refreshIfOlder(int maxAge)
+			throw (ECommFailure);
+
+		/// How often to reload everything instead of only changed entries.
+		/**
+		 * @param  interval  Seconds between full reloads, or 0 to never reload.
+		 *   Edits to existing entries can be this old.  The default is five
+		 *   minutes.
+		 */
+		void setReloadInterval(int interval)
+			throw ();
+
+		/// Call refresh() from a background thread at a regular interval.
+		/**
+		 * Errors are not thrown but can be retrieved with getLastError().  This
+		 * includes being unable to start the thread, in which case there will
+		 * be no background refreshes.
+		 *
+		 * @param  interval  Seconds between refreshes.
+		 */
+		void startRefresh(int interval)
+			throw ();
+
+		/// Stop the background thread started by startRefresh().
+		void stopRefresh()
+			throw ();
+
+		/// Get a copy of an entry.
+		/**
+		 * @return true if the entry was found, false if it isn't in the replica.
+		 */
+		bool get(const AddressBook::EntryId& id, AddressBook::Record& entry) const
+			throw ();
+
+		/// Get the IDs of every entry in the replica.
+		void getEntryIds(AddressBook::VC_ENTRYID& ids) const
+			throw ();
+
+		/// Pass every entry in the replica to a callback.
+		/**
+		 * The replica can't be refreshed until this returns, so visit should not
+		 * take long.
+		 *
+		 * @return true if every entry was visited, false if visit stopped early.
+		 */
+		bool visit(AddressBook::FN_VISIT visit) const
+			throw ();
+
+		/// Number of entries in the replica.
+		unsigned int size() const
+			throw ();
+
+		/// Time of the last successful refresh, or 0 if there hasn't been one.
+		time_t getLastRefresh() const
+			throw ();
+
+		/// Reason the last background refresh failed, or empty if it worked.
+		std::string getLastError() const
+			throw ();
+
+	protected:
+		typedef std::map<AddressBook::EntryId, AddressBook::Record> MP_ENTRY;
+		typedef std::map<AddressBook::EntryId, std::string> MP_INDEX;
+
+		AddressBookPtr ab;
+		AddressBook::VC_FIELD fields;
+
+		/// Held while refreshing, so only one refresh talks to the device.
+		boost::mutex refreshLock;
+
+		/// Protects everything below.
+		mutable boost::shared_mutex dataLock;
+
+		MP_ENTRY entries;     ///< Copy of each entry
+		MP_INDEX indexes;     ///< Index of each entry when it was retrieved
+		time_t lastRefresh;   ///< When entries was last brought up to date
+		time_t lastLoad;      ///< When entries was last loaded in full
+		int reloadInterval;   ///< Seconds between full reloads, 0 for never
+		std::string lastError;
+
+		/// Background refresh thread, if running.
+		boost::shared_ptr<boost::thread> refresher;
+
+		/// Signalled to wake the background thread when stopping.
+		boost::condition_variable stopSignal;
+
+		/// Protects stopping.
+		boost::mutex stopLock;
+
+		/// true when the background thread should exit.
+		bool stopping;
+
+		/// Retrieve the whole address book.  refreshLock must be held.
+		void loadLocked()
+			throw (ECommFailure);
+
+		/// Retrieve changed entries.  refreshLock must be held.
+		void updateLocked()
+			throw (ECommFailure);
+
+		/// Background thread entry point.
+		void refreshThread(int interval)
+			throw ();
+
+		/// FN_VISIT callback that copies each entry into a map.
+		static bool storeEntry(MP_ENTRY *entries, const AddressBook::EntryId& id,
+			const AddressBook::Record& entry)
+			throw ();
+
+		/// Index of an entry, or empty if it doesn't have one.
+		static std::string indexOf(const AddressBook::Record& entry)
+			throw ();
+
+};
+
+/// Shared pointer to a Replica.
+typedef boost::shared_ptr<Replica> ReplicaPtr;
+
+} // namespace mfd
+
+#endif // _LIBMFD_REPLICA_HPP_
@@ -0,0 +1,174 @@
+/**
+ * @file   scheduler.hpp
+ * @brief  WriteScheduler class, for writing entries with the address book
+ *         locked for as little time as possible.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_SCHEDULER_HPP_
+#define _LIBMFD_SCHEDULER_HPP_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Collects entry updates and writes them in one short burst.
+/**
+ * While an address book is being written to, nobody else can use it, not even
+ * from the device's front panel.  To keep this as short as possible, flush()
+ * does all the work it can before locking the address book:
+ *
+ *  - The entries are read again and any fields that already have the new
+ *    value are dropped, along with entries that no longer exist.  This also
+ *    means a flush that failed part way through can safely be repeated.
+ *
+ *  - Every request is built in advance, so once the address book is locked
+ *    the only thing left to do is send them.
+ *
+ * The time the address book was locked for is reported for each flush.
+ *
+ * Changes to the same entry are merged while they wait, so however many times
+ * an entry is changed it is only written once per flush.  Flushing can be
+ * left to a background thread with startWriteBehind(), which flushes once
+ * enough entries are waiting or the oldest change has waited long enough.
+ *
+ * @note Multithreading: Any function may be called from any thread.  The
+ *       scheduler must be the only writer to the AddressBook while it exists,
+ *       and the AddressBook must not be used from elsewhere during a flush.
+ */
+class WriteScheduler {
+
+	public:
+		/**
+		 * @param  ab  Address book to write to.
+		 */
+		WriteScheduler(AddressBookPtr ab)
+			throw ();
+
+		/// Stops the background thread if it is running, flushing first.
+		~WriteScheduler()
+			throw ();
+
+		/// Queue a change to an entry.
+		/**
+		 * If the entry already has changes queued, these are merged in, with
+		 * the newest value of each field kept.
+		 */
+		void add(const AddressBook::EntryId& id, const AddressBook::FieldList& update)
+			throw ();
+
+		/// Number of entries with changes queued.
+		unsigned int size() const
+			throw ();
+
+		/// Write all the queued changes.
+		/**
+		 * @param  stats  Receives the number of entries written and skipped,
+		 *   and how long the address book was locked for.
+		 *
+		 * @throws ECommFailure if the entries could not be read or written.
+		 *         The changes remain queued, so flush() can be called again.
+		 */
+		void flush(AddressBook::BatchStats& stats)
+			throw (ECommFailure);
+
+		/// Flush from a background thread whenever there is enough to write.
+		/**
+		 * Errors are not thrown but can be retrieved with getLastError().  The
+		 * changes stay queued and are tried again after maxDelay, even if
+		 * maxEntries is reached sooner.  If the thread can't be started, that
+		 * is reported the same way, and changes wait for flush() to be called.
+		 *
+		 * @param  maxEntries  Flush as soon as this many entries are waiting, or
+		 *   0 to only flush on time.
+		 * @param  maxDelay  Flush once the oldest change has waited this many
+		 *   seconds.
+		 */
+		void startWriteBehind(unsigned int maxEntries, int maxDelay)
+			throw ();
+
+		/// Stop the thread started by startWriteBehind(), flushing first.
+		void stopWriteBehind()
+			throw ();
+
+		/// Result of the last background flush.
+		AddressBook::BatchStats getLastStats() const
+			throw ();
+
+		/// Reason the last background flush failed, or empty if it worked.
+		std::string getLastError() const
+			throw ();
+
+	protected:
+		AddressBookPtr ab;
+
+		/// Held while flushing, so only one flush talks to the device.
+		boost::mutex flushLock;
+
+		/// Protects everything below.
+		mutable boost::mutex queueLock;
+
+		AddressBook::MP_UPDATE pending;  ///< Queued changes
+		boost::system_time firstQueued;  ///< When pending was last empty
+		AddressBook::BatchStats lastStats;
+		std::string lastError;
+
+		/// Background flush thread, if running.
+		boost::shared_ptr<boost::thread> writer;
+
+		/// Signalled when the background thread may have something to do.
+		boost::condition_variable wake;
+
+		unsigned int maxEntries;  ///< Background flush size trigger, 0 for none
+		int maxDelay;             ///< Background flush time trigger, in seconds
+		bool stopping;            ///< true when the background thread should exit
+		bool retrying;            ///< true from a failed flush until one works
+
+		/// Read back and write a batch of changes.
+		void write(const AddressBook::MP_UPDATE& batch,
+			AddressBook::BatchStats& stats)
+			throw (ECommFailure);
+
+		/// Background thread entry point.
+		void writeThread()
+			throw ();
+
+		/// Flush, saving the result in lastStats and lastError.
+		void backgroundFlush()
+			throw ();
+
+		/// FN_VISIT callback that moves an entry's changed fields to updates.
+		/**
+		 * Fields that already have the new value are dropped, and the entry is
+		 * removed from remaining whether or not anything needs changing.
+		 */
+		static bool takeChanged(AddressBook::MP_UPDATE *remaining,
+			AddressBook::MP_UPDATE *updates, const AddressBook::EntryId& id,
+			const AddressBook::Record& entry)
+			throw ();
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_SCHEDULER_HPP_
@@ -0,0 +1,122 @@
+/**
+ * @file   sync.hpp
+ * @brief  Sync class, bringing an address book into line with a list of
+ *         entries.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_SYNC_HPP_
+#define _LIBMFD_SYNC_HPP_
+
+#include <map>
+#include <stdexcept>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Changes needed to bring an address book into line with a list of entries.
+struct SyncPlan {
+	AddressBook::VC_FIELDLIST creates;  ///< Entries to add
+	AddressBook::MP_UPDATE updates;     ///< Only the fields that differ
+	AddressBook::VC_ENTRYID deletes;    ///< Entries to remove
+	unsigned int unchanged;             ///< Entries already correct
+
+	SyncPlan()
+		throw ();
+
+	/// Is the address book already up to date?
+	bool empty() const
+		throw ();
+};
+
+/// Bring an address book into line with a list of desired entries.
+/**
+ * Entries are matched up by a key field, such as the e-mail address.  The
+ * current entries are read in a single pass, retrieving only the key and the
+ * fields that appear in the desired entries.  Only the fields whose values
+ * differ are written back, so an address book that is already up to date
+ * costs one read and no writes.
+ *
+ * @code
+ * Sync sync(ab, AddressBook::EmailAddress);
+ * sync.setDeleteUnmatched(true);
+ * SyncPlan plan;
+ * sync.run(desired, plan);
+ * std::cout << plan.creates.size() << " added, " << plan.updates.size()
+ *   << " changed, " << plan.deletes.size() << " removed\n";
+ * @endcode
+ *
+ * @note Fields the device won't read back, such as passwords, will look
+ *       different every time and so will always be written.
+ */
+class Sync {
+
+	public:
+		/**
+		 * @param  ab   Address book to change.
+		 * @param  key  Field identifying an entry.  Each desired entry must
+		 *   have a unique, non-empty value for it.
+		 */
+		Sync(AddressBookPtr ab, AddressBook::Field key)
+			throw ();
+
+		/// Should entries not in the desired list be removed?
+		/**
+		 * @param  remove  true to remove them, false (the default) to leave them
+		 *   alone.
+		 */
+		void setDeleteUnmatched(bool remove)
+			throw ();
+
+		/// Work out what needs to change, without changing anything.
+		/**
+		 * @param  desired  Entries the address book should contain.
+		 * @param  plan     Receives the changes.
+		 *
+		 * @throws std::invalid_argument if a desired entry has no key, or two of
+		 *         them have the same key.
+		 */
+		void plan(const AddressBook::VC_FIELDLIST& desired, SyncPlan& plan)
+			throw (ECommFailure, std::invalid_argument);
+
+		/// Make the changes worked out by plan().
+		/**
+		 * Entries are removed, then changed, then added, all while the address
+		 * book is locked for writing only once.
+		 */
+		void apply(const SyncPlan& plan)
+			throw (ECommFailure);
+
+		/// Work out what needs to change and then change it.
+		/**
+		 * @param  desired  Entries the address book should contain.
+		 * @param  plan     Receives the changes that were made.
+		 */
+		void run(const AddressBook::VC_FIELDLIST& desired, SyncPlan& plan)
+			throw (ECommFailure, std::invalid_argument);
+
+	protected:
+		AddressBookPtr ab;
+		AddressBook::Field key;
+		bool deleteUnmatched;
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_SYNC_HPP_
@@ -0,0 +1,108 @@
+/**
+ * @file   view.hpp
+ * @brief  EntryView class, giving access to entries without copying them.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_VIEW_HPP_
+#define _LIBMFD_VIEW_HPP_
+
+#include <boost/shared_ptr.hpp>
+#include <ostream>
+#include <string>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Characters owned by something else.
+/**
+ * The characters are not NUL-terminated, and are only valid for as long as
+ * whatever they came from.
+ */
+struct StringRef {
+	const char *data;     ///< First character
+	unsigned int length;  ///< Number of characters
+
+	/// Empty string.
+	StringRef()
+		throw ();
+
+	/// Refer to the contents of a std::string.
+	StringRef(const std::string& s)
+		throw ();
+
+	/// Copy the characters into a std::string.
+	std::string str() const
+		throw ();
+
+	bool empty() const
+		throw ()
+	{
+		return this->length == 0;
+	}
+};
+
+/// Write a StringRef to a stream.
+std::ostream& operator << (std::ostream& s, const StringRef& r)
+	throw ();
+
+/// Read-only list of address book entries, referring to the device's buffers.
+/**
+ * Nothing is copied out of the response from the device, so this is the
+ * cheapest way to pass entries through to somewhere else, such as writing
+ * them to a file.
+ *
+ * @note The view keeps the response it refers to in memory until the view is
+ *       destroyed, so it stays valid across later calls to its AddressBook
+ *       from any thread.  Hold on to it only as long as needed.
+ */
+class EntryView {
+
+	public:
+		virtual ~EntryView()
+			throw ();
+
+		/// Can the entries still be accessed?
+		virtual bool valid() const
+			throw () = 0;
+
+		/// Number of entries in the view.
+		virtual unsigned int size() const
+			throw () = 0;
+
+		/// Does an entry have a value for the field?
+		/**
+		 * Fields that were not asked for never have a value.
+		 */
+		virtual bool has(unsigned int row, AddressBook::Field field) const
+			throw () = 0;
+
+		/// Get an entry's value for a field.
+		/**
+		 * @return The value, or an empty string if has() would return false.
+		 */
+		virtual StringRef get(unsigned int row, AddressBook::Field field) const
+			throw () = 0;
+
+};
+
+// EntryViewPtr is declared in addressbook.hpp
+
+} // namespace mfd
+
+#endif // _LIBMFD_VIEW_HPP_
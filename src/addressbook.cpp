@@ -0,0 +1,242 @@
+/**
+ * @file   addressbook.cpp
+ * @brief  Interface to an MFD's address book.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/static_assert.hpp>
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+// Record keeps one bit per field in a 64-bit mask
+BOOST_STATIC_ASSERT(AddressBook::FieldCount <= 64);
+
+/// Number of entries to request at once in visitEntries()
+#define VISIT_BATCH_SIZE  100
+
+/// Append FieldList copies of each Record.
+void appendFieldLists(const AddressBook::VC_RECORD& records,
+	AddressBook::VC_FIELDLIST& results)
+	throw ()
+{
+	results.reserve(results.size() + records.size());
+	for (AddressBook::VC_RECORD::const_iterator i = records.begin(); i != records.end(); i++) {
+		results.push_back(AddressBook::FieldList());
+		i->toFieldList(results.back());
+	}
+	return;
+}
+
+AddressBook::Cursor::Cursor()
+	throw () :
+		position(0),
+		total(-1),
+		finished(false)
+{
+}
+
+AddressBook::BatchStats::BatchStats()
+	throw () :
+		written(0),
+		skipped(0),
+		missing(0),
+		lockWait(0),
+		lockHeld(0)
+{
+}
+
+AddressBook::CacheStats::CacheStats()
+	throw () :
+		hits(0),
+		misses(0),
+		evictions(0),
+		size(0)
+{
+}
+
+AddressBook::Record::Record()
+	throw () :
+		present(0)
+{
+}
+
+AddressBook::Record::Record(const FieldList& fl)
+	throw (std::length_error) :
+		present(0)
+{
+	for (FieldList::const_iterator i = fl.begin(); i != fl.end(); i++) {
+		this->set(i->first, i->second);
+	}
+}
+
+std::string AddressBook::Record::get(Field field) const
+	throw ()
+{
+	if (!this->has(field)) return std::string();
+	return this->data.substr(this->offset[field], this->length[field]);
+}
+
+void AddressBook::Record::set(Field field, const char *value,
+	std::string::size_type len
+)
+	throw (std::length_error)
+{
+	std::string::size_type start = this->data.length();
+	if ((start + len > 0xFFFF) || (len > 0xFFFF)) {
+		throw std::length_error("Address book entry is too large");
+	}
+	this->data.append(value, len);
+	this->offset[field] = start;
+	this->length[field] = len;
+	this->present |= (boost::uint64_t)1 << field;
+	return;
+}
+
+void AddressBook::Record::erase(Field field)
+	throw ()
+{
+	this->present &= ~((boost::uint64_t)1 << field);
+	return;
+}
+
+void AddressBook::Record::clear()
+	throw ()
+{
+	this->present = 0;
+	this->data.clear();
+	return;
+}
+
+void AddressBook::Record::toFieldList(FieldList& fl) const
+	throw ()
+{
+	for (int f = 0; f < FieldCount; f++) {
+		if (this->has((Field)f)) {
+			fl[(Field)f].assign(this->data, this->offset[f], this->length[f]);
+		}
+	}
+	return;
+}
+
+void AddressBook::getAllEntries(const VC_FIELD& fields, VC_FIELDLIST& results)
+	throw (ECommFailure)
+{
+	VC_RECORD records;
+	this->getAllEntries(fields, records);
+	appendFieldLists(records, results);
+	return;
+}
+
+void AddressBook::getAllEntries(VC_FIELDLIST& results)
+	throw (ECommFailure)
+{
+	this->getAllEntries(VC_FIELD(), results);
+	return;
+}
+
+bool AddressBook::visitAllEntries(const VC_FIELD& fields, FN_VISIT visit)
+	throw (ECommFailure)
+{
+	Cursor cursor;
+	VC_ENTRYID ids;
+	VC_RECORD page;
+	while (!cursor.finished) {
+		this->scanEntries(cursor, fields, ids, page);
+		for (unsigned int i = 0; i < page.size(); i++) {
+			if (!visit(ids[i], page[i])) return false;
+		}
+	}
+	return true;
+}
+
+bool AddressBook::visitEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+	FN_VISIT visit
+)
+	throw (ECommFailure)
+{
+	VC_ENTRYID batch, found;
+	VC_RECORD page;
+	for (VC_ENTRYID::const_iterator i = ids.begin(); i != ids.end(); ) {
+		VC_ENTRYID::const_iterator end = i + std::min<VC_ENTRYID::size_type>(
+			VISIT_BATCH_SIZE, ids.end() - i);
+		batch.assign(i, end);
+		// Missing entries are left out, so go by the IDs that came back
+		found.clear();
+		page.clear();
+		this->getEntries(batch, fields, found, page);
+		for (unsigned int j = 0; j < page.size(); j++) {
+			if (!visit(found[j], page[j])) return false;
+		}
+		i = end;
+	}
+	return true;
+}
+
+void AddressBook::find(const Query& query, VC_FIELDLIST& results)
+	throw (ECommFailure)
+{
+	VC_RECORD records;
+	this->find(query, records);
+	appendFieldLists(records, results);
+	return;
+}
+
+void AddressBook::getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+	VC_FIELDLIST& results
+)
+	throw (ECommFailure)
+{
+	VC_RECORD records;
+	this->getEntries(ids, fields, records);
+	appendFieldLists(records, results);
+	return;
+}
+
+void AddressBook::getEntries(const VC_ENTRYID& ids, VC_FIELDLIST& results)
+	throw (ECommFailure)
+{
+	this->getEntries(ids, VC_FIELD(), results);
+	return;
+}
+
+void AddressBook::applyBatch(const MP_UPDATE& updates)
+	throw (ECommFailure)
+{
+	BatchStats stats;
+	this->applyBatch(updates, stats);
+	return;
+}
+
+AddressBook::EntryId AddressBook::createEntry(const FieldList& fields)
+	throw (ECommFailure)
+{
+	VC_ENTRYID ids;
+	this->createEntries(VC_FIELDLIST(1, fields), ids);
+	if (ids.empty()) throw ECommFailure("Device did not return the new entry's ID");
+	return ids[0];
+}
+
+void AddressBook::deleteEntry(const EntryId& id)
+	throw (ECommFailure)
+{
+	this->deleteEntries(VC_ENTRYID(1, id));
+	return;
+}
+
+} // namespace mfd
@@ -0,0 +1,111 @@
+/**
+ * @file   batcher.cpp
+ * @brief  LookupBatcher class, for combining single entry lookups into one
+ *         request.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batcher.hpp"
+
+namespace mfd {
+
+LookupBatcher::Batch::Batch()
+	throw () :
+		failed(false),
+		done(false)
+{
+}
+
+LookupBatcher::LookupBatcher(FN_FETCH fetch)
+	throw () :
+		fetch(fetch),
+		maxIds(0),
+		window(0)
+{
+}
+
+void LookupBatcher::setLimits(unsigned int maxIds, int window)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	this->maxIds = maxIds;
+	this->window = window;
+	return;
+}
+
+bool LookupBatcher::enabled() const
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	return this->maxIds > 0;
+}
+
+bool LookupBatcher::get(const AddressBook::EntryId& id,
+	AddressBook::FieldList& entry
+)
+	throw (ECommFailure)
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	BatchPtr batch = this->open;
+	bool leader = !batch;
+	if (leader) {
+		batch.reset(new Batch);
+		this->open = batch;
+	}
+	batch->ids.push_back(id);
+	if (batch->ids.size() >= this->maxIds) {
+		// Full, so send it now.  Later lookups start a new batch.
+		this->open.reset();
+		this->changed.notify_all();
+	}
+
+	if (leader) {
+		// Give other lookups a chance to join, unless the batch fills first
+		boost::system_time due = boost::get_system_time()
+			+ boost::posix_time::milliseconds(this->window);
+		while ((this->open == batch) && (this->changed.timed_wait(lock, due))) {
+			// Woken by another batch, keep waiting
+		}
+		if (this->open == batch) this->open.reset();
+
+		lock.unlock();
+		try {
+			this->fetch(batch->ids, batch->entries);
+		} catch (const ECommFailure& e) {
+			batch->failed = true;
+			batch->error = e.what();
+		} catch (...) {
+			// The rest of the batch must still be woken, and only ECommFailure
+			// can be passed on to them or thrown from here.
+			batch->failed = true;
+			batch->error = "Unexpected error while retrieving the batch";
+		}
+		lock.lock();
+		batch->done = true;
+		this->changed.notify_all();
+	} else {
+		while (!batch->done) this->changed.wait(lock);
+	}
+
+	if (batch->failed) throw ECommFailure(batch->error);
+	MP_ENTRY::iterator i = batch->entries.find(id);
+	if (i == batch->entries.end()) return false;
+	entry = i->second;
+	return true;
+}
+
+} // namespace mfd
@@ -0,0 +1,122 @@
+/**
+ * @file   batcher.hpp
+ * @brief  LookupBatcher class, for combining single entry lookups into one
+ *         request.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_BATCHER_HPP_
+#define _LIBMFD_BATCHER_HPP_
+
+#include <map>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Combine lookups of single entries from many threads into one request.
+/**
+ * The first lookup starts a batch and waits for a short time, during which
+ * lookups from other threads join the same batch.  Once the time is up or
+ * the batch is full, every entry in it is retrieved with one request and
+ * each thread is handed its own entry.
+ *
+ * This adds up to the batch window to each lookup, in exchange for far fewer
+ * requests when lookups arrive in bursts.
+ */
+class LookupBatcher {
+
+	public:
+		typedef std::map<AddressBook::EntryId, AddressBook::FieldList> MP_ENTRY;
+
+		/// Function retrieving a batch of entries.
+		/**
+		 * Entries that don't exist are left out of the results.
+		 */
+		typedef boost::function<void (const AddressBook::VC_ENTRYID& ids,
+			MP_ENTRY& entries)> FN_FETCH;
+
+		/**
+		 * @param  fetch  Called to retrieve each batch.
+		 *
+		 * @note Batching is off until setLimits() is called.
+		 */
+		LookupBatcher(FN_FETCH fetch)
+			throw ();
+
+		/// Change how lookups are batched.
+		/**
+		 * @param  maxIds  Send the batch as soon as it has this many entries,
+		 *   or 0 to turn batching off.
+		 * @param  window  Milliseconds to wait for more entries before sending
+		 *   the batch.
+		 */
+		void setLimits(unsigned int maxIds, int window)
+			throw ();
+
+		/// Is batching turned on?
+		bool enabled() const
+			throw ();
+
+		/// Look up an entry as part of a batch.
+		/**
+		 * @param  id     Entry to look up.
+		 * @param  entry  On success, set to the entry's details.
+		 * @return true on success, false if the entry doesn't exist.
+		 * @throws ECommFailure if the batch couldn't be retrieved.
+		 */
+		bool get(const AddressBook::EntryId& id, AddressBook::FieldList& entry)
+			throw (ECommFailure);
+
+	protected:
+		/// Lookups being retrieved together.
+		struct Batch {
+			AddressBook::VC_ENTRYID ids;
+			MP_ENTRY entries;
+			std::string error;  ///< Reason for failure, if failed is true
+			bool failed;
+			bool done;          ///< true once entries has been filled in
+
+			Batch()
+				throw ();
+		};
+		typedef boost::shared_ptr<Batch> BatchPtr;
+
+		FN_FETCH fetch;
+
+		/// Protects everything below.
+		mutable boost::mutex lock;
+
+		/// Signalled when a batch fills up or has been retrieved.
+		boost::condition_variable changed;
+
+		/// Batch new lookups join, or NULL if the next lookup starts one.
+		BatchPtr open;
+
+		unsigned int maxIds;
+		int window;
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_BATCHER_HPP_
@@ -0,0 +1,214 @@
+/**
+ * @file   cache.cpp
+ * @brief  DeviceCache class, used to remember autodetection results between
+ *         runs.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>   // rename()
+#include <cstdlib>  // strtol()
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>  // open()
+#include <sys/file.h> // flock()
+#include <unistd.h> // close(), getpid()
+#include <libmfd/cache.hpp>
+
+/*
+ * The cache file is plain text, one host per line, with tab-separated fields:
+ *
+ *   hostname  deviceCode  updated  [Dname=value...]  [Vname=value...]
+ *
+ * where the D fields are DeviceProbe::details and the V fields are the
+ * Device::VersionInfo properties.  Backslashes, tabs, newlines and equal signs
+ * within names and values are escaped with a backslash.
+ */
+
+namespace mfd {
+
+/// Escape a string so it can be written as a single cache field.
+std::string cacheEscape(const std::string& in)
+{
+	std::string out;
+	out.reserve(in.length());
+	for (std::string::const_iterator i = in.begin(); i != in.end(); i++) {
+		switch (*i) {
+			case '\\': out.append("\\\\"); break;
+			case '\t': out.append("\\t"); break;
+			case '\n': out.append("\\n"); break;
+			case '=':  out.append("\\="); break;
+			default:   out.push_back(*i); break;
+		}
+	}
+	return out;
+}
+
+/// Reverse cacheEscape().
+std::string cacheUnescape(const std::string& in)
+{
+	std::string out;
+	out.reserve(in.length());
+	for (std::string::const_iterator i = in.begin(); i != in.end(); i++) {
+		if ((*i == '\\') && (i + 1 != in.end())) {
+			i++;
+			switch (*i) {
+				case 't': out.push_back('\t'); break;
+				case 'n': out.push_back('\n'); break;
+				default:  out.push_back(*i); break;
+			}
+		} else {
+			out.push_back(*i);
+		}
+	}
+	return out;
+}
+
+/// Split an escaped name=value field at the first unescaped equal sign.
+bool cacheSplit(const std::string& in, std::string *name, std::string *value)
+{
+	for (std::string::size_type i = 0; i < in.length(); i++) {
+		if (in[i] == '\\') {
+			i++; // skip escaped char
+		} else if (in[i] == '=') {
+			*name = cacheUnescape(in.substr(0, i));
+			*value = cacheUnescape(in.substr(i + 1));
+			return true;
+		}
+	}
+	return false;
+}
+
+DeviceCache::DeviceCache(const std::string& filename, int ttl)
+	throw () :
+		filename(filename),
+		ttl(ttl)
+{
+}
+
+DeviceCache::~DeviceCache()
+	throw ()
+{
+}
+
+bool DeviceCache::lookup(const std::string& hostname, Entry& entry) const
+	throw ()
+{
+	// No lock is needed to read, as the file is only ever replaced atomically
+	MP_ENTRY entries;
+	this->load(entries);
+	MP_ENTRY::const_iterator i = entries.find(hostname);
+	if (i == entries.end()) return false;
+	if (time(NULL) - i->second.updated > this->ttl) return false;
+	entry = i->second;
+	return true;
+}
+
+bool DeviceCache::store(const std::string& hostname, const Entry& entry)
+	throw ()
+{
+	return this->update(hostname, &entry);
+}
+
+bool DeviceCache::invalidate(const std::string& hostname)
+	throw ()
+{
+	return this->update(hostname, NULL);
+}
+
+void DeviceCache::load(MP_ENTRY& entries) const
+	throw ()
+{
+	std::ifstream file(this->filename.c_str());
+	std::string line;
+	while (std::getline(file, line)) {
+		std::vector<std::string> fields;
+		std::string::size_type start = 0, end;
+		do {
+			end = line.find('\t', start);
+			fields.push_back(line.substr(start, end - start));
+			start = end + 1;
+		} while (end != std::string::npos);
+		if (fields.size() < 3) continue; // corrupted line
+
+		Entry& entry = entries[cacheUnescape(fields[0])];
+		entry.deviceCode = cacheUnescape(fields[1]);
+		entry.updated = strtol(fields[2].c_str(), NULL, 10);
+		for (unsigned int i = 3; i < fields.size(); i++) {
+			std::string name, value;
+			if (fields[i].empty()) continue;
+			if (!cacheSplit(fields[i].substr(1), &name, &value)) continue;
+			switch (fields[i][0]) {
+				case 'D': entry.details[name] = value; break;
+				case 'V': entry.versionInfo[name] = value; break;
+			}
+		}
+	}
+	return;
+}
+
+bool DeviceCache::update(const std::string& hostname, const Entry *entry)
+	throw ()
+{
+	// Hold an exclusive lock while reading and rewriting the file, so that
+	// other processes updating different hosts don't undo our change.
+	std::string lockname = this->filename + ".lock";
+	int lockfd = ::open(lockname.c_str(), O_RDWR | O_CREAT, 0644);
+	if (lockfd < 0) return false;
+	if (flock(lockfd, LOCK_EX) < 0) {
+		::close(lockfd);
+		return false;
+	}
+
+	MP_ENTRY entries;
+	this->load(entries);
+	if (entry) entries[hostname] = *entry;
+	else entries.erase(hostname);
+
+	std::ostringstream tmpname;
+	tmpname << this->filename << ".tmp." << getpid();
+	bool ok;
+	{
+		std::ofstream file(tmpname.str().c_str(), std::ios::trunc);
+		for (MP_ENTRY::const_iterator i = entries.begin(); i != entries.end(); i++) {
+			file << cacheEscape(i->first) << '\t'
+				<< cacheEscape(i->second.deviceCode) << '\t'
+				<< (long)i->second.updated;
+			for (std::map<std::string, std::string>::const_iterator j =
+				i->second.details.begin(); j != i->second.details.end(); j++
+			) {
+				file << "\tD" << cacheEscape(j->first) << '=' << cacheEscape(j->second);
+			}
+			for (Device::VersionInfo::const_iterator j =
+				i->second.versionInfo.begin(); j != i->second.versionInfo.end(); j++
+			) {
+				file << "\tV" << cacheEscape(j->first) << '=' << cacheEscape(j->second);
+			}
+			file << '\n';
+		}
+		file.close();
+		ok = !file.fail();
+	}
+	if (ok) ok = (rename(tmpname.str().c_str(), this->filename.c_str()) == 0);
+	if (!ok) unlink(tmpname.str().c_str());
+
+	flock(lockfd, LOCK_UN);
+	::close(lockfd);
+	return ok;
+}
+
+} // namespace mfd
@@ -0,0 +1,132 @@
+/**
+ * @file   columns.cpp
+ * @brief  EntryColumns class, holding address book entries field by field.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libmfd/columns.hpp>
+
+namespace mfd {
+
+EntryColumns::Column::Column()
+	throw ()
+{
+}
+
+std::string EntryColumns::Column::get(unsigned int row) const
+	throw ()
+{
+	return this->arena.substr(this->start(row), this->length(row));
+}
+
+void EntryColumns::Column::append(const char *value, unsigned int len)
+	throw ()
+{
+	if (len) this->arena.append(value, len);
+	this->ends.push_back(this->arena.length());
+	return;
+}
+
+void EntryColumns::Column::reserve(unsigned int rows, unsigned int bytes)
+	throw ()
+{
+	this->ends.reserve(this->ends.size() + rows);
+	this->arena.reserve(this->arena.length() + bytes);
+	return;
+}
+
+void EntryColumns::Column::clear()
+	throw ()
+{
+	this->arena.clear();
+	this->ends.clear();
+	return;
+}
+
+EntryColumns::EntryColumns()
+	throw ()
+{
+	for (int i = 0; i < AddressBook::FieldCount; i++) this->columnIndex[i] = -1;
+}
+
+void EntryColumns::addField(AddressBook::Field field)
+	throw ()
+{
+	if (this->hasField(field)) return;
+	this->columnIndex[field] = this->columns.size();
+	this->fields.push_back(field);
+	this->columns.push_back(Column());
+	this->pending.push_back(std::make_pair((const char *)NULL, 0u));
+
+	// Pad the new column so it lines up with the rows already stored
+	Column& col = this->columns.back();
+	for (unsigned int i = 0; i < this->size(); i++) col.append(NULL, 0);
+	return;
+}
+
+void EntryColumns::reserve(unsigned int rows)
+	throw ()
+{
+	// Assume IDs are short and other fields average a few dozen bytes
+	this->idColumn.reserve(rows, rows * 8);
+	for (std::vector<Column>::iterator i = this->columns.begin(); i != this->columns.end(); i++) {
+		i->reserve(rows, rows * 32);
+	}
+	return;
+}
+
+void EntryColumns::clear()
+	throw ()
+{
+	this->idColumn.clear();
+	for (std::vector<Column>::iterator i = this->columns.begin(); i != this->columns.end(); i++) {
+		i->clear();
+	}
+	return;
+}
+
+void EntryColumns::beginRow(const std::string& id)
+	throw ()
+{
+	this->idColumn.append(id.data(), id.length());
+	for (unsigned int i = 0; i < this->pending.size(); i++) {
+		this->pending[i].first = NULL;
+		this->pending[i].second = 0;
+	}
+	return;
+}
+
+void EntryColumns::set(AddressBook::Field field, const std::string& value)
+	throw ()
+{
+	int c = this->columnIndex[field];
+	if (c < 0) return;
+	this->pending[c].first = value.data();
+	this->pending[c].second = value.length();
+	return;
+}
+
+void EntryColumns::endRow()
+	throw ()
+{
+	for (unsigned int i = 0; i < this->columns.size(); i++) {
+		this->columns[i].append(this->pending[i].first, this->pending[i].second);
+	}
+	return;
+}
+
+} // namespace mfd
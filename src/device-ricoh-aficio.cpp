@@ -18,7 +18,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm> // std::min(), std::max()
+#include <boost/bind.hpp>
 #include <unistd.h> // sleep()
+#include <sys/time.h> // gettimeofday()
+#include <sys/socket.h> // MSG_NOSIGNAL
 #include "device-ricoh-aficio.hpp"
 #include "uDirectory.nsmap"
 
@@ -26,272 +30,1332 @@ namespace mfd {
 
 #define SESSION_TIMEOUT    30
 
+/// Number of rows to request in the first page of a search
+#define PAGE_SIZE_INITIAL  50
+
+/// Never shrink pages below this many rows
+#define PAGE_SIZE_MIN      10
+
+/// Never grow pages above this many rows
+#define PAGE_SIZE_MAX      1000
+
+/// Stop growing pages once each row takes this much longer than before
+#define PAGE_CLIFF_FACTOR  1.5
+
+/// Number of entries kept by getEntry()
+#define ENTRY_CACHE_SIZE   100
+
+/// Number of seconds getEntry() keeps an entry for
+#define ENTRY_CACHE_TTL    60
+
+/// Properties to retrieve for each address book entry.
+std::string entryFields[] = {"entryType", "id", "name", "longName",
+	/*"phoneticName", */"index",/* "passwordEncoding", "isDestination", "isSender",
+	"auth:", "auth:name", "auth:password", "password:", "password:password",
+	"password:usedForMailSender", "password:usedForRemoteFolder",
+	"password:passwordEncoding", "mail:", */"mail:address",/* "mail:parameter",
+	"mail:isDirectSMTP", "fax:", "fax:number", "fax:lineType", "fax:isAbroad",
+	"fax:parameter", "faxAux:", "faxAux:ttiNo", "faxAux:label1",
+	"faxAux:label2String", "faxAux:messageNo", "remoteFolder:",
+	"remoteFolder:type", "remoteFolder:serverName", "remoteFolder:path",
+	"remoteFolder:accountName", "remoteFolder:password", "remoteFolder:port",
+	"remoteFolder:characterEncoding", "remoteFolder:passwordEncoding",
+	"remoteFolder:select", "remoteFolder:logonMode",
+	"ldap:", "ldap:accountName", "ldap:password", "ldap:passwordEncoding",
+	"ldap:select",
+	"smtp:", "smtp:accountName", "smtp:password", "smtp:passwordEncoding",
+	"smtp:select",
+	"ifax:", "ifax:address", "ifax:parameter", "ifax:isDirectSMTP",*/
+	"tagId"
+};
+
+/// Pairing of a uDirectory property name with its AddressBook::Field.
+struct FieldName {
+	const char *propName;
+	AddressBook::Field field;
+};
+
+/// uDirectory property names for each AddressBook::Field.
+const FieldName fieldNames[] = {
+	{"id",                             AddressBook::Id},
+	{"name",                           AddressBook::Name},
+	{"mail:address",                   AddressBook::EmailAddress},
+	{"index",                          AddressBook::Index},
+	{"entryType",                      AddressBook::EntryType},
+	{"longName",                       AddressBook::LongName},
+	{"phoneticName",                   AddressBook::PhoneticName},
+	{"tagId",                          AddressBook::TagId},
+	{"passwordEncoding",               AddressBook::PasswordEncoding},
+	{"isDestination",                  AddressBook::IsDestination},
+	{"isSender",                       AddressBook::IsSender},
+	{"auth:name",                      AddressBook::AuthName},
+	{"auth:password",                  AddressBook::AuthPassword},
+	{"password:password",              AddressBook::Password},
+	{"password:usedForMailSender",     AddressBook::PasswordForMailSender},
+	{"password:usedForRemoteFolder",   AddressBook::PasswordForRemoteFolder},
+	{"password:passwordEncoding",      AddressBook::PasswordPasswordEncoding},
+	{"mail:parameter",                 AddressBook::EmailParameter},
+	{"mail:isDirectSMTP",              AddressBook::EmailDirectSMTP},
+	{"fax:number",                     AddressBook::FaxNumber},
+	{"fax:lineType",                   AddressBook::FaxLineType},
+	{"fax:isAbroad",                   AddressBook::FaxIsAbroad},
+	{"fax:parameter",                  AddressBook::FaxParameter},
+	{"faxAux:ttiNo",                   AddressBook::FaxTTINo},
+	{"faxAux:label1",                  AddressBook::FaxLabel1},
+	{"faxAux:label2String",            AddressBook::FaxLabel2},
+	{"faxAux:messageNo",               AddressBook::FaxMessageNo},
+	{"remoteFolder:type",              AddressBook::FolderType},
+	{"remoteFolder:serverName",        AddressBook::FolderServerName},
+	{"remoteFolder:path",              AddressBook::FolderPath},
+	{"remoteFolder:accountName",       AddressBook::FolderAccountName},
+	{"remoteFolder:password",          AddressBook::FolderPassword},
+	{"remoteFolder:port",              AddressBook::FolderPort},
+	{"remoteFolder:characterEncoding", AddressBook::FolderCharacterEncoding},
+	{"remoteFolder:passwordEncoding",  AddressBook::FolderPasswordEncoding},
+	{"remoteFolder:select",            AddressBook::FolderSelect},
+	{"remoteFolder:logonMode",         AddressBook::FolderLogonMode},
+	{"ldap:accountName",               AddressBook::LdapAccountName},
+	{"ldap:password",                  AddressBook::LdapPassword},
+	{"ldap:passwordEncoding",          AddressBook::LdapPasswordEncoding},
+	{"ldap:select",                    AddressBook::LdapSelect},
+	{"smtp:accountName",               AddressBook::SmtpAccountName},
+	{"smtp:password",                  AddressBook::SmtpPassword},
+	{"smtp:passwordEncoding",          AddressBook::SmtpPasswordEncoding},
+	{"smtp:select",                    AddressBook::SmtpSelect},
+	{"ifax:address",                   AddressBook::IfaxAddress},
+	{"ifax:parameter",                 AddressBook::IfaxParameter},
+	{"ifax:isDirectSMTP",              AddressBook::IfaxDirectSMTP},
+};
+
+/// uDirectory queryTerm operator for each Query::Operator.
+const char *queryOperators[] = {
+	"=",          // Equal
+	"!=",         // NotEqual
+	"<",          // Less
+	"<=",         // LessEqual
+	">",          // Greater
+	">=",         // GreaterEqual
+	"includes",   // Contains
+	"startsWith", // StartsWith
+	"between",    // Between
+};
+
+/// Get the uDirectory property name for a field.
+/**
+ * @return The property name, or NULL if the field has no equivalent.
+ */
+const char *fieldToPropName(AddressBook::Field field)
+{
+	for (unsigned int i = 0; i < sizeof(fieldNames) / sizeof(fieldNames[0]); i++) {
+		if (fieldNames[i].field == field) return fieldNames[i].propName;
+	}
+	return NULL;
+}
+
+/// Build the list of properties to retrieve for the given fields.
+/**
+ * @param  soap       SOAP context to allocate the result in.
+ * @param  fields     Fields to retrieve, or empty for entryFields.
+ * @param  propNames  Storage for the property names, which must outlive the
+ *                    returned array.
+ *
+ * @throws ECommFailure if a field has no uDirectory equivalent.
+ */
+stringArray *fieldsToSelectProps(struct soap *soap,
+	const AddressBook::VC_FIELD& fields, VC_STRING& propNames)
+	throw (ECommFailure)
+{
+	stringArray *sa = soap_new_stringArray(soap, -1);
+	if (fields.empty()) {
+		sa->__ptr = entryFields;
+		sa->__size = sizeof(entryFields) / sizeof(entryFields[0]);
+		return sa;
+	}
+
+	// The ID is always needed to tell the entries apart
+	propNames.clear();
+	propNames.reserve(fields.size() + 1);
+	propNames.push_back("id");
+	for (AddressBook::VC_FIELD::const_iterator i = fields.begin(); i != fields.end(); i++) {
+		if (*i == AddressBook::Id) continue;
+		const char *propName = fieldToPropName(*i);
+		if (!propName) throw ECommFailure("This device does not have that field");
+		propNames.push_back(propName);
+	}
+	sa->__ptr = &propNames[0];
+	sa->__size = propNames.size();
+	return sa;
+}
+
+/// Find a property in a search result row.
+/**
+ * @return The property's value, or NULL if the row doesn't have it.
+ */
+const std::string *findProp(const propertyList& row, const char *name)
+	throw ()
+{
+	for (int j = 0; j < row.__size; j++) {
+		if (row.__ptr[j]->propName.compare(name) == 0) return &row.__ptr[j]->propVal;
+	}
+	return NULL;
+}
+
+/// Does the value of an "id" property belong to a normal entry?
+bool isEntryIdProp(const std::string& val)
+	throw ()
+{
+	//std::cout << "Addr book entry: " << val << std::endl;
+	unsigned long v = strtoul(val.c_str(), NULL, 0);
+	if (v >= 1<<30) {
+		//std::cout << "out of range: " << val << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// Convert the value of an entry's "id" property into an entry ID.
+/**
+ * @return true on success, false if the ID isn't for a normal entry.
+ */
+bool propToEntryId(const std::string& val, AddressBook::EntryId& id)
+	throw ()
+{
+	if (!isEntryIdProp(val)) return false;
+	id = "entry:";
+	id.append(val);
+	return true;
+}
+
+/// Get the number of seconds elapsed since start.
+double elapsedSince(const struct timeval& start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
 stringArray *vectorToStringArray(struct soap* soap, const VC_STRING& v)
 {
-	stringArray *sa = soap_new_stringArray(soap, -1);//v.size());
-	sa->__size = v.size();
-	sa->__ptr = const_cast<std::string *>(&v[0]);
-	/*
-	//std::string *strs = (std::string *)soap_malloc(soap, sizeof(std::string) * sa.__size);
-	std::string *strs = new std::string[sa->__size]; // TODO: This never gets freed
-	int j = 0;
-	//std::string *strs = soap_new_std__string(soap, v.size());
-	for (VC_STRING::const_iterator i = v.begin(); i != v.end(); i++) {
-		//sa->__ptr[j++] = *i;
-		strs[j++] = *i;
+	stringArray *sa = soap_new_stringArray(soap, -1);//v.size());
+	sa->__size = v.size();
+	sa->__ptr = const_cast<std::string *>(&v[0]);
+	/*
+	//std::string *strs = (std::string *)soap_malloc(soap, sizeof(std::string) * sa.__size);
+	std::string *strs = new std::string[sa->__size]; // TODO: This never gets freed
+	int j = 0;
+	//std::string *strs = soap_new_std__string(soap, v.size());
+	for (VC_STRING::const_iterator i = v.begin(); i != v.end(); i++) {
+		//sa->__ptr[j++] = *i;
+		strs[j++] = *i;
+	}
+	//sa.__ptr = s;
+	sa->__ptr = strs;
+	*/
+	return sa;
+}
+
+/// Convert a map of property names and values into a uDirectory propertyList.
+/**
+ * The result is allocated in the SOAP context and freed along with it.
+ */
+propertyList *mapToPropertyList(struct soap* soap, const MP_PROPERTYLIST& map)
+{
+	propertyList *pl = soap_new_propertyList(soap, -1);
+	pl->__size = map.size();
+	pl->__ptr = (itt__property **)soap_malloc(soap,
+		sizeof(itt__property *) * pl->__size);
+	int j = 0;
+	for (MP_PROPERTYLIST::const_iterator i = map.begin(); i != map.end(); i++) {
+		pl->__ptr[j] = soap_new_itt__property(soap, -1);
+		pl->__ptr[j]->propName = i->first;
+		pl->__ptr[j]->propVal = i->second;
+		j++;
+	}
+	return pl;
+}
+
+/// Convert entry fields into uDirectory property names and values.
+/**
+ * @throws ECommFailure if a field has no uDirectory equivalent.
+ */
+void fieldListToMap(const AddressBook::FieldList& fields, MP_PROPERTYLIST& map)
+	throw (ECommFailure)
+{
+	for (AddressBook::FieldList::const_iterator i = fields.begin(); i != fields.end(); i++) {
+		const char *propName = fieldToPropName(i->first);
+		if ((!propName) || (i->first == AddressBook::Id)) {
+			throw ECommFailure("This device cannot store that field");
+		}
+		map[propName] = i->second;
+	}
+	return;
+}
+
+/// Convert an object ID returned by a write into an entry ID.
+/**
+ * @return true on success, false if the ID isn't for a normal entry.
+ */
+bool objectIdToEntryId(const std::string& objectId, AddressBook::EntryId& id)
+	throw ()
+{
+	if (objectId.compare(0, 6, "entry:") == 0) {
+		id = objectId;
+		return true;
+	}
+	return propToEntryId(objectId, id);
+}
+
+
+uDirectoryClient::uDirectoryClient(const std::string& hostname)
+	throw () :
+		uDirectoryProxy(SOAP_IO_KEEPALIVE),
+		callType(ReadCall),
+		freshConnection(false),
+		reusedConnection(false)
+{
+	this->stats.requests = 0;
+	this->stats.connects = 0;
+	this->stats.reconnects = 0;
+
+	this->endpoint = "http://";
+	this->endpoint.append(hostname);
+	this->endpoint.append("/DH/udirectory");
+	this->soap_endpoint = this->endpoint.c_str();
+
+#ifdef MSG_NOSIGNAL
+	// Writing to a connection the device has closed would otherwise kill the
+	// process with SIGPIPE, instead of returning an error we can recover from.
+	this->socket_flags = MSG_NOSIGNAL;
+#endif
+
+	this->fopenDefault = this->fopen;
+	this->fopen = uDirectoryClient::fopenCount;
+	this->fpostDefault = this->fpost;
+	this->fpost = uDirectoryClient::fpostCount;
+}
+
+void uDirectoryClient::beginCall(CallType type)
+	throw ()
+{
+	this->callType = type;
+	if (type == WriteCall) this->closeConnection();
+	return;
+}
+
+bool uDirectoryClient::retryCall(int ret)
+	throw ()
+{
+	if (ret == SOAP_OK) return false;
+	// The device may have carried out the call and only lost the reply
+	if (this->callType != ReadCall) return false;
+	if (!this->reusedConnection) return false;
+	if (
+		(this->error != SOAP_EOF) &&
+		(this->error != SOAP_TCP_ERROR)
+	) return false;
+
+	// The device dropped the kept-alive connection, so close our end.  The next
+	// call will open a new connection, which won't be retried if it too fails.
+	this->closeConnection();
+	this->stats.reconnects++;
+	return true;
+}
+
+void uDirectoryClient::closeConnection()
+	throw ()
+{
+	this->keep_alive = 0;
+	soap_closesock(this);
+	this->reusedConnection = false;
+	return;
+}
+
+void uDirectoryClient::release()
+	throw ()
+{
+	soap_destroy(this);
+	soap_end(this);
+	return;
+}
+
+SOAP_SOCKET uDirectoryClient::fopenCount(struct soap *soap,
+	const char *endpoint, const char *host, int port)
+{
+	uDirectoryClient *client = static_cast<uDirectoryClient *>(soap);
+	client->stats.connects++;
+	client->freshConnection = true;
+	return client->fopenDefault(soap, endpoint, host, port);
+}
+
+int uDirectoryClient::fpostCount(struct soap *soap, const char *endpoint,
+	const char *host, int port, const char *path, const char *action,
+	size_t count)
+{
+	uDirectoryClient *client = static_cast<uDirectoryClient *>(soap);
+	client->stats.requests++;
+	client->reusedConnection = !client->freshConnection;
+	client->freshConnection = false;
+	return client->fpostDefault(soap, endpoint, host, port, path, action, count);
+}
+
+
+PropertyAtoms::PropertyAtoms()
+	throw ()
+{
+	// fieldNames starts with "id", so it gets IdAtom
+	for (unsigned int i = 0; i < sizeof(fieldNames) / sizeof(fieldNames[0]); i++) {
+		Atom a = this->atom(fieldNames[i].propName);
+		this->fields[a] = fieldNames[i].field;
+	}
+}
+
+PropertyAtoms::Atom PropertyAtoms::atom(const std::string& name)
+	throw ()
+{
+	std::map<std::string, Atom>::iterator i = this->index.find(name);
+	if (i != this->index.end()) return i->second;
+
+	Atom a = this->names.size();
+	this->index[name] = a;
+	this->names.push_back(name);
+	this->fields.push_back(AddressBook::FieldCount);
+	return a;
+}
+
+PropertyAtoms::Atom PropertyAtoms::atomAt(unsigned int position,
+	const std::string& name
+)
+	throw ()
+{
+	if (position < this->lastRow.size()) {
+		Atom a = this->lastRow[position];
+		if (this->names[a].compare(name) == 0) return a;
+	} else {
+		this->lastRow.resize(position + 1);
+	}
+	Atom a = this->atom(name);
+	this->lastRow[position] = a;
+	return a;
+}
+
+ESearchRefused::ESearchRefused(const std::string& msg)
+	: ECommFailure(msg)
+{
+}
+
+RowSink::~RowSink()
+	throw ()
+{
+}
+
+IdsSink::IdsSink(AddressBook::VC_ENTRYID& ids, PropertyAtoms& atoms)
+	throw () :
+		ids(ids),
+		atoms(atoms)
+{
+}
+
+void IdsSink::reserve(int rows)
+	throw ()
+{
+	if (this->ids.capacity() < (unsigned int)rows) this->ids.reserve(rows);
+	return;
+}
+
+void IdsSink::addRow(const propertyList& row)
+	throw (ECommFailure)
+{
+	for (int j = 0; j < row.__size; j++) {
+		if (this->atoms.atomAt(j, row.__ptr[j]->propName) == PropertyAtoms::IdAtom) {
+			AddressBook::EntryId id;
+			if (propToEntryId(row.__ptr[j]->propVal, id)) this->ids.push_back(id);
+			break;
+		}
+	}
+	return;
+}
+
+RecordsSink::RecordsSink(AddressBook::VC_RECORD& records,
+	PropertyAtoms& atoms, AddressBook::VC_ENTRYID *ids, bool entriesOnly
+)
+	throw () :
+		records(records),
+		atoms(atoms),
+		ids(ids),
+		entriesOnly(entriesOnly)
+{
+}
+
+void RecordsSink::reserve(int rows)
+	throw ()
+{
+	// Allow for anything already in the lists
+	this->records.reserve(this->records.size() + rows);
+	if (this->ids) this->ids->reserve(this->ids->size() + rows);
+	return;
+}
+
+void RecordsSink::addRow(const propertyList& row)
+	throw (ECommFailure)
+{
+	this->records.push_back(AddressBook::Record());
+	AddressBook::Record& rec = this->records.back();
+	const std::string *idVal = NULL;
+	try {
+		for (int j = 0; j < row.__size; j++) {
+			PropertyAtoms::Atom a = this->atoms.atomAt(j, row.__ptr[j]->propName);
+			if (a == PropertyAtoms::IdAtom) idVal = &row.__ptr[j]->propVal;
+			AddressBook::Field f = this->atoms.field(a);
+			if (f != AddressBook::FieldCount) rec.set(f, row.__ptr[j]->propVal);
+			// else field isn't one we know about, ignore it and keep going
+		}
+	} catch (const std::length_error& e) {
+		// Don't leave half an entry behind without a matching ID
+		this->records.pop_back();
+		throw ECommFailure("Device returned an address book entry that is too large");
+	}
+
+	if ((this->entriesOnly) || (this->ids)) {
+		AddressBook::EntryId id;
+		if ((!idVal) || (!propToEntryId(*idVal, id))) {
+			if (this->entriesOnly) this->records.pop_back();
+			return;
+		}
+		if (this->ids) this->ids->push_back(id);
+	}
+	return;
+}
+
+ColumnsSink::ColumnsSink(EntryColumns& columns, PropertyAtoms& atoms)
+	throw () :
+		columns(columns),
+		atoms(atoms)
+{
+}
+
+void ColumnsSink::reserve(int rows)
+	throw ()
+{
+	this->columns.reserve(rows);
+	return;
+}
+
+void ColumnsSink::addRow(const propertyList& row)
+	throw (ECommFailure)
+{
+	const std::string *idVal = NULL;
+	for (int j = 0; j < row.__size; j++) {
+		if (this->atoms.atomAt(j, row.__ptr[j]->propName) == PropertyAtoms::IdAtom) {
+			idVal = &row.__ptr[j]->propVal;
+			break;
+		}
+	}
+	AddressBook::EntryId id;
+	if ((!idVal) || (!propToEntryId(*idVal, id))) return;
+
+	this->columns.beginRow(id);
+	for (int j = 0; j < row.__size; j++) {
+		AddressBook::Field f = this->atoms.field(
+			this->atoms.atomAt(j, row.__ptr[j]->propName));
+		if (f != AddressBook::FieldCount) {
+			this->columns.set(f, row.__ptr[j]->propVal);
+		} // else field isn't one we know about, ignore it and keep going
+	}
+	this->columns.endRow();
+	return;
+}
+
+EntryView_RicohAficio::EntryView_RicohAficio(
+	const AddressBook::VC_FIELD& fields, PropertyAtoms& atoms,
+	boost::shared_ptr<uDirectoryClient> response, bool entriesOnly
+)
+	throw () :
+		atoms(atoms),
+		response(response),
+		entriesOnly(entriesOnly),
+		numRows(0),
+		numColumns(0)
+{
+	for (int i = 0; i < AddressBook::FieldCount; i++) this->column[i] = -1;
+	for (AddressBook::VC_FIELD::const_iterator i = fields.begin(); i != fields.end(); i++) {
+		if (this->column[*i] < 0) this->column[*i] = this->numColumns++;
+	}
+}
+
+EntryView_RicohAficio::~EntryView_RicohAficio()
+	throw ()
+{
+}
+
+bool EntryView_RicohAficio::valid() const
+	throw ()
+{
+	// The response can't be freed while this view holds it
+	return true;
+}
+
+unsigned int EntryView_RicohAficio::size() const
+	throw ()
+{
+	return this->numRows;
+}
+
+bool EntryView_RicohAficio::has(unsigned int row,
+	AddressBook::Field field
+) const
+	throw ()
+{
+	return this->cell(row, field) != NULL;
+}
+
+StringRef EntryView_RicohAficio::get(unsigned int row,
+	AddressBook::Field field
+) const
+	throw ()
+{
+	const std::string *val = this->cell(row, field);
+	if (!val) return StringRef();
+	return StringRef(*val);
+}
+
+void EntryView_RicohAficio::reserve(int rows)
+	throw ()
+{
+	this->cells.reserve((this->numRows + rows) * this->numColumns);
+	return;
+}
+
+void EntryView_RicohAficio::addRow(const propertyList& row)
+	throw (ECommFailure)
+{
+	unsigned int first = this->cells.size();
+	this->cells.resize(first + this->numColumns, NULL);
+	bool isEntry = false;
+	for (int j = 0; j < row.__size; j++) {
+		PropertyAtoms::Atom a = this->atoms.atomAt(j, row.__ptr[j]->propName);
+		if (a == PropertyAtoms::IdAtom) isEntry = isEntryIdProp(row.__ptr[j]->propVal);
+		AddressBook::Field f = this->atoms.field(a);
+		if ((f != AddressBook::FieldCount) && (this->column[f] >= 0)) {
+			this->cells[first + this->column[f]] = &row.__ptr[j]->propVal;
+		}
+	}
+	if ((this->entriesOnly) && (!isEntry)) {
+		this->cells.resize(first);
+		return;
+	}
+	this->numRows++;
+	return;
+}
+
+SearchCriteria::SearchCriteria()
+	throw () :
+		whereAnd(NULL),
+		whereOr(NULL),
+		orderBy(NULL)
+{
+}
+
+DeviceProbe_RicohAficio::DeviceProbe_RicohAficio(const std::string& hostname,
+	E_CERTAINTY certainty, uDirectoryClientPtr client
+)
+	throw () :
+		DeviceProbe(hostname, certainty),
+		client(client)
+{
+}
+
+DeviceProbe_RicohAficio::~DeviceProbe_RicohAficio()
+	throw ()
+{
+}
+
+
+std::string DeviceType_RicohAficio::getDeviceCode() const
+	throw ()
+{
+	return "ricoh-aficio";
+}
+
+std::string DeviceType_RicohAficio::getFriendlyName() const
+	throw ()
+{
+	return "Ricoh Aficio-compatible";
+}
+
+E_CERTAINTY DeviceType_RicohAficio::isInstance(const std::string& hostname,
+	int timeout
+) const
+	throw (std::ios::failure)
+{
+	return this->probe(hostname, timeout)->certainty;
+}
+
+DeviceProbePtr DeviceType_RicohAficio::probe(const std::string& hostname,
+	int timeout
+) const
+	throw (std::ios::failure)
+{
+	// Send off a SOAP request to get the protocol version
+	uDirectoryClientPtr client(new uDirectoryClient(hostname));
+	client->connect_timeout = timeout;
+	client->send_timeout = timeout;
+	client->recv_timeout = timeout;
+	int ver;
+	if (client->getProtocolVersion(ver) == SOAP_OK) {
+		DeviceProbePtr probe(new DeviceProbe_RicohAficio(hostname,
+			EC_DEFINITELY_YES, client));
+		std::ostringstream ss;
+		ss << ver;
+		probe->details["protocolVersion"] = ss.str();
+		return probe;
+	}
+	// SOAP request failed, not a supported device
+	return DeviceProbePtr(new DeviceProbe_RicohAficio(hostname,
+		EC_DEFINITELY_NO, uDirectoryClientPtr()));
+}
+
+DevicePtr DeviceType_RicohAficio::open(const std::string& hostname,
+	const std::string& username, const std::string& password
+) const
+	throw (ECommFailure)
+{
+	return DevicePtr(new Device_RicohAficio(hostname, username, password));
+}
+
+DevicePtr DeviceType_RicohAficio::open(DeviceProbePtr probe,
+	const std::string& username, const std::string& password
+) const
+	throw (ECommFailure)
+{
+	// detect() returns a NULL probe when nothing matched
+	if (!probe) throw ECommFailure("Can't open a device that wasn't found");
+	return DevicePtr(new Device_RicohAficio(probe->hostname, username, password,
+		probe));
+}
+
+
+Device_RicohAficio::Device_RicohAficio(const std::string& hostname,
+	const std::string& username, const std::string& password,
+	DeviceProbePtr probe
+)
+	throw (ECommFailure) :
+		hostname(hostname),
+		username(username),
+		password(password),
+		protocolVersion(0),
+		sessionType(NoSession),
+		pageSize(PAGE_SIZE_INITIAL),
+		pageSizeLimit(PAGE_SIZE_MAX),
+		pageRowTime(0),
+		pageRefused(0),
+		keysetPaging(true),
+		entryCache(ENTRY_CACHE_SIZE, ENTRY_CACHE_TTL),
+		lookups(boost::bind(&Device_RicohAficio::fetchEntries, this, _1, _2))
+{
+	if (probe) {
+		// Take over the probe's connection (if it has one), without the short
+		// probe timeouts.  Probes recreated from the cache won't have one.
+		boost::shared_ptr<DeviceProbe_RicohAficio> ricohProbe =
+			boost::dynamic_pointer_cast<DeviceProbe_RicohAficio>(probe);
+		if ((ricohProbe) && (ricohProbe->client)) {
+			this->ud = ricohProbe->client;
+			ricohProbe->client.reset();
+			this->ud->connect_timeout = 0;
+			this->ud->send_timeout = 0;
+			this->ud->recv_timeout = 0;
+		}
+		std::map<std::string, std::string>::const_iterator ver =
+			probe->details.find("protocolVersion");
+		if (ver != probe->details.end()) {
+			this->protocolVersion = strtol(ver->second.c_str(), NULL, 10);
+		}
+		this->versionInfo = probe->versionInfo;
+	}
+	if (!this->ud) this->ud.reset(new uDirectoryClient(hostname));
+
+	// Nothing is sent to the device until udirRequireSession() is called by the
+	// first function that needs it.
+
+/*
+	std::string p1("id");
+	std::string p2("label");
+	//std::string *props[1];
+	//props[0] = &p;
+	selectProps.__ptr = new std::string[2];
+	selectProps.__size = 2;
+	selectProps.__ptr[0] = p1;
+	selectProps.__ptr[1] = p2;
+
+	VC_RESULTS labels;
+	this->udirSearch(&selectProps, "tag", "3", 0, 10, labels);
+
+	std::cout << "Tags (type 3):" << std::endl;
+	for (VC_RESULTS::iterator i = labels.begin(); i != labels.end(); i++) {
+		std::cout << "  ";
+		for (MP_PROPERTYLIST::iterator j = i->begin(); j != i->end(); j++) {
+			std::cout << j->first << "=" << j->second << "; ";
+		}
+		std::cout << std::endl;
+	}
+*/
+
+
+}
+
+Device_RicohAficio::~Device_RicohAficio()
+	throw ()
+{
+	try {
+		this->udirCloseSession();
+	} catch (const ECommFailure& e) {
+		// Nothing we can do, the session will time out on the device eventually
+	}
+}
+
+// Change the value of a metadata element.
+AddressBookPtr Device_RicohAficio::getAddressBook()
+	throw ()
+{
+	return boost::static_pointer_cast<AddressBook>(shared_from_this());
+}
+
+ConnectionStats Device_RicohAficio::getConnectionStats() const
+	throw ()
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	return this->ud->stats;
+}
+
+const Device::VersionInfo& Device_RicohAficio::getVersionInfo()
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	if (this->versionInfo.empty()) {
+		ud__getServiceVersionResponse sr;
+		int ret;
+		this->ud->beginCall(uDirectoryClient::ReadCall);
+		do {
+			ret = this->ud->getServiceVersion(sr);
+		} while (this->ud->retryCall(ret));
+		if (ret != SOAP_OK) {
+			std::cerr << "[udir] getServiceVersion() failed:" << std::endl;
+			this->ud->soap_stream_fault(std::cerr);
+			throw ECommFailure("SOAP error in getServiceVersion()");
+		}
+		propertyList *items = sr.returnValue;
+		for (int i = 0; i < items->__size; i++) {
+			this->versionInfo[items->__ptr[i]->propName] = items->__ptr[i]->propVal;
+		}
+	}
+	return this->versionInfo;
+}
+
+const char *Device_RicohAficio::getFieldName(Field field) const
+	throw ()
+{
+	return fieldToPropName(field);
+}
+
+AddressBook::VC_ENTRYID Device_RicohAficio::getEntryIds()
+	throw (ECommFailure)
+{
+	// Other threads asking at the same time wait here, then find the list
+	// already retrieved, so they share the one request
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	if (this->entryIds.empty()) {
+		this->udirRequireSession();
+
+		VC_STRING fields;
+		fields.push_back(std::string("id"));
+		stringArray *addrObjectFields = vectorToStringArray(this->ud.get(), fields);
+		// Only keep the list once it's complete, as an empty list is how we
+		// know to ask again
+		VC_ENTRYID ids;
+		IdsSink sink(ids, this->atoms);
+		this->udirSearchAll(addrObjectFields, "entry", "", SearchCriteria(), sink);
+		this->entryIds.swap(ids);
+	}
+	return this->entryIds;
+}
+
+void Device_RicohAficio::scanEntryIds(Cursor& cursor, VC_ENTRYID& ids)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	ids.clear();
+	if (cursor.finished) return;
+	this->udirRequireSession();
+
+	VC_STRING fields;
+	fields.push_back(std::string("id"));
+	stringArray *addrObjectFields = vectorToStringArray(this->ud.get(), fields);
+	IdsSink sink(ids, this->atoms);
+	this->udirSearchPage(addrObjectFields, "entry", "", SearchCriteria(), cursor,
+		sink);
+	return;
+}
+
+void Device_RicohAficio::scanEntries(Cursor& cursor, const VC_FIELD& fields,
+	VC_ENTRYID& ids, VC_RECORD& results
+)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	ids.clear();
+	results.clear();
+	if (cursor.finished) return;
+	this->udirRequireSession();
+
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(), fields,
+		propNames);
+	RecordsSink sink(results, this->atoms, &ids, true);
+	this->udirSearchPage(selectProps, "entry", "", SearchCriteria(), cursor,
+		sink);
+	return;
+}
+
+void Device_RicohAficio::getAllEntries(const VC_FIELD& fields,
+	VC_RECORD& results
+)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
+
+	// Ask for the fields in the search itself, instead of searching for the
+	// IDs and then asking for the fields in a second request.
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(), fields,
+		propNames);
+
+	// The IDs come for free, so remember them for getEntryIds(), but only if
+	// the whole list arrives
+	VC_ENTRYID ids;
+	RecordsSink sink(results, this->atoms, &ids, true);
+	this->udirSearchAll(selectProps, "entry", "", SearchCriteria(), sink);
+	this->entryIds.swap(ids);
+	return;
+}
+
+void Device_RicohAficio::getAllEntries(EntryColumns& results)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
+
+	if (results.getFields().empty()) {
+		VC_FIELD fields;
+		this->defaultFields(fields);
+		for (VC_FIELD::iterator i = fields.begin(); i != fields.end(); i++) {
+			if (*i != Id) results.addField(*i);
+		}
+	}
+
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(),
+		results.getFields(), propNames);
+	ColumnsSink sink(results, this->atoms);
+	this->udirSearchAll(selectProps, "entry", "", SearchCriteria(), sink);
+	return;
+}
+
+void Device_RicohAficio::find(const Query& query, VC_RECORD& results)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
+
+	SearchCriteria criteria;
+	criteria.whereAnd = this->udirQueryTerms(query.allOf);
+	criteria.whereOr = this->udirQueryTerms(query.anyOf);
+	criteria.orderBy = this->udirOrderBy(query.sortOrder);
+
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(), query.fields,
+		propNames);
+	RecordsSink sink(results, this->atoms, NULL, true);
+	if (query.maxResults == 0) {
+		this->udirSearchAll(selectProps, "entry", "", criteria, sink);
+	} else {
+		// Only ask for as many rows as we need, which is usually a single
+		// request unless the device returns fewer rows than asked for.  Count
+		// the entries kept rather than the rows, as the sink drops rows that
+		// aren't entries.
+		unsigned int start = results.size();
+		Cursor cursor;
+		while ((!cursor.finished) && (results.size() - start < query.maxResults)) {
+			int count = this->udirSearch(selectProps, "entry", "", criteria, cursor,
+				query.maxResults - (results.size() - start), sink);
+			if (count == 0) break;
+		}
+		if (results.size() > start + query.maxResults) {
+			results.resize(start + query.maxResults);
+		}
 	}
-	//sa.__ptr = s;
-	sa->__ptr = strs;
-	*/
-	return sa;
+	return;
 }
 
-propertyList *mapToPropertyList(struct soap* soap, MP_PROPERTYLIST& map)
+AddressBook::FieldList Device_RicohAficio::getEntry(const EntryId& id)
+	throw (ECommFailure)
 {
-	propertyList *pl = soap_new_propertyList(soap, -1);
-	pl->__size = map.size();
-	//*pl->__ptr = soap_new_itt__property(soap, pl->__size);
-	//std::string *strs = (std::string *)soap_malloc(soap, sizeof(std::string) * sa.__size);
-	//itt__property **pp = new itt__property*;
-	//itt__property *props = soap_new_itt__property(soap, pl->__size);
-	itt__property **props = new itt__property*[pl->__size];
-	//memcpy(props, props2, sizeof(itt_property) * pl->__size);
-	//delete[] props2;
-	int j = 0;
-	for (MP_PROPERTYLIST::iterator i = map.begin(); i != map.end(); i++) {
-		props[j] = new itt__property;
-		props[j]->propName = i->first;
-		props[j]->propVal = i->second;
-		j++;
+	FieldList entry;
+	if (this->entryCache.lookup(id, entry)) return entry;
+
+	// Threads asking for the same entry at once share a single request
+	return this->entryFetches.run(id,
+		boost::bind(&Device_RicohAficio::fetchEntry, this, id));
+}
+
+AddressBook::FieldList Device_RicohAficio::fetchEntry(const EntryId& id)
+	throw (ECommFailure)
+{
+	FieldList entry;
+	if (this->lookups.enabled()) {
+		// Wait for lookups from other threads, and retrieve them together.
+		// fetchEntries() adds them to the cache.
+		if (!this->lookups.get(id, entry)) {
+			throw ECommFailure("No such entry: " + id);
+		}
+		return entry;
 	}
-	//*pp = props;
-	pl->__ptr = props; // props will be deallocated on return! (bad)
-	return pl;
+
+	// Keep the device locked until the entry is cached, so a change made in
+	// between can't be overwritten by the old details.
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	VC_RECORD records;
+	this->getEntries(VC_ENTRYID(1, id), VC_FIELD(), records);
+	// A missing entry comes back as a row without an ID
+	if ((records.empty()) || (!records[0].has(Id))) {
+		throw ECommFailure("No such entry: " + id);
+	}
+	records[0].toFieldList(entry);
+	this->entryCache.store(id, entry);
+	return entry;
 }
 
+void Device_RicohAficio::fetchEntries(const VC_ENTRYID& ids,
+	LookupBatcher::MP_ENTRY& entries
+)
+	throw (ECommFailure)
+{
+	// Cache the entries before the device is unlocked, as in fetchEntry()
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
 
-std::string DeviceType_RicohAficio::getDeviceCode() const
+	// Match the rows up by ID, as missing entries may be left out
+	VC_RECORD records;
+	VC_ENTRYID found;
+	this->getEntries(ids, VC_FIELD(), found, records);
+	for (unsigned int i = 0; i < records.size(); i++) {
+		FieldList& entry = entries[found[i]];
+		records[i].toFieldList(entry);
+		this->entryCache.store(found[i], entry);
+	}
+	return;
+}
+
+void Device_RicohAficio::setEntryBatching(unsigned int maxEntries, int window)
 	throw ()
 {
-	return "ricoh-aficio";
+	this->lookups.setLimits(maxEntries, window);
+	return;
 }
 
-std::string DeviceType_RicohAficio::getFriendlyName() const
+void Device_RicohAficio::setEntryCache(unsigned int maxEntries, int ttl)
 	throw ()
 {
-	return "Ricoh Aficio-compatible";
+	this->entryCache.setLimits(maxEntries, ttl);
+	return;
 }
 
-E_CERTAINTY DeviceType_RicohAficio::isInstance(const std::string& hostname) const
-	throw (std::ios::failure)
+AddressBook::CacheStats Device_RicohAficio::getEntryCacheStats() const
+	throw ()
 {
-	// Send off a SOAP request to get the protocol version
-	uDirectoryProxy ud;
-	std::string endpoint = "http://";
-	endpoint.append(hostname);
-	endpoint.append("/DH/udirectory");
-	ud.soap_endpoint = endpoint.c_str();
-	int dummy;
-	if (ud.getProtocolVersion(dummy) == SOAP_OK) return EC_DEFINITELY_YES;
-	// SOAP request failed, not a supported device
-	return EC_DEFINITELY_NO;
+	return this->entryCache.getStats();
 }
 
-DevicePtr DeviceType_RicohAficio::open(const std::string& hostname,
-	const std::string& username, const std::string& password
-) const
+void Device_RicohAficio::getEntries(const AddressBook::VC_ENTRYID& ids,
+	const VC_FIELD& fields, AddressBook::VC_RECORD& results
+)
 	throw (ECommFailure)
 {
-	return DevicePtr(new Device_RicohAficio(hostname, username, password));
-}
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
 
+	RecordsSink sink(results, this->atoms, NULL, false);
+	this->udirGetEntries(ids, fields, sink);
+	return;
+}
 
-Device_RicohAficio::Device_RicohAficio(const std::string& hostname,
-	const std::string& username, const std::string& password
+void Device_RicohAficio::getEntries(const AddressBook::VC_ENTRYID& ids,
+	const VC_FIELD& fields, AddressBook::VC_ENTRYID& found,
+	AddressBook::VC_RECORD& results
 )
-	throw (ECommFailure) :
-		hostname(hostname)
+	throw (ECommFailure)
 {
-	// Map the uDirectory field strings to Field variables
-	this->fieldMap["id"] = Id;
-	this->fieldMap["name"] = Name;
-	this->fieldMap["mail:address"] = EmailAddress;
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
 
-	std::string endpoint = "http://";
-	endpoint.append(this->hostname);
-	endpoint.append("/DH/udirectory");
-	this->ud.soap_endpoint = endpoint.c_str();
-	int ver;
-	if (ud.getProtocolVersion(ver) == SOAP_OK) {
-		if ((ver < 302) || (ver > 304)) {
-			std::cerr << "Warning: This device is using an unknown protocol version "
-				<< ver << std::endl;
-		}
-	} else {
-		std::cerr << "Unable to contact device via HTTP/SOAP:" << std::endl;
-		this->ud.soap_stream_fault(std::cerr);
-		throw ECommFailure("Unable to contact device via HTTP/SOAP.");
-	}
+	RecordsSink sink(results, this->atoms, &found, true);
+	this->udirGetEntries(ids, fields, sink);
+	return;
+}
 
-	ud__getServiceVersionResponse sr;
-	if (this->ud.getServiceVersion(sr) == SOAP_OK) {
-		propertyList *items = sr.returnValue;
-		std::cout << "Service version response: ";
-		for (int i = 0; i < items->__size; i++) {
-			std::cout
-				<< items->__ptr[i]->propName << "="
-				<< items->__ptr[i]->propVal << "; ";
-		}
-		std::cout << std::endl;
-	} else {
-		this->ud.soap_stream_fault(std::cerr);
-	}
+EntryViewPtr Device_RicohAficio::viewAllEntries(const VC_FIELD& fields)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
 
-	if (!this->udirOpenSession(SharedSession)) {
-		throw std::ios::failure("Unable to log in - bad password?");
-	}
+	VC_FIELD viewFields(fields);
+	if (viewFields.empty()) this->defaultFields(viewFields);
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(), viewFields,
+		propNames);
+	boost::shared_ptr<EntryView_RicohAficio> view(
+		new EntryView_RicohAficio(viewFields, this->atoms, this->ud, true));
+	this->udirSearchAll(selectProps, "entry", "", SearchCriteria(), *view);
+	return view;
+}
 
-/*
-	std::string p1("id");
-	std::string p2("label");
-	//std::string *props[1];
-	//props[0] = &p;
-	selectProps.__ptr = new std::string[2];
-	selectProps.__size = 2;
-	selectProps.__ptr[0] = p1;
-	selectProps.__ptr[1] = p2;
+EntryViewPtr Device_RicohAficio::viewEntries(const VC_ENTRYID& ids,
+	const VC_FIELD& fields
+)
+	throw (ECommFailure)
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	this->udirRequireSession();
 
-	VC_RESULTS labels;
-	this->udirSearch(&selectProps, "tag", "3", 0, 10, labels);
+	VC_FIELD viewFields(fields);
+	if (viewFields.empty()) this->defaultFields(viewFields);
+	boost::shared_ptr<EntryView_RicohAficio> view(
+		new EntryView_RicohAficio(viewFields, this->atoms, this->ud, false));
+	this->udirGetEntries(ids, viewFields, *view);
+	return view;
+}
 
-	std::cout << "Tags (type 3):" << std::endl;
-	for (VC_RESULTS::iterator i = labels.begin(); i != labels.end(); i++) {
-		std::cout << "  ";
-		for (MP_PROPERTYLIST::iterator j = i->begin(); j != i->end(); j++) {
-			std::cout << j->first << "=" << j->second << "; ";
-		}
-		std::cout << std::endl;
+void Device_RicohAficio::releaseViews()
+	throw ()
+{
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	// Views are only created with deviceLock held, so if none hold the client
+	// now, none can until the next call.
+	if (this->ud.unique()) {
+		this->ud->release();
+		return;
 	}
-*/
+	// Leave the old SOAP context to the views still reading from it, it will be
+	// freed along with the last of them, and carry on with a new client.
+	uDirectoryClientPtr fresh(new uDirectoryClient(this->hostname));
+	fresh->stats = this->ud->stats;
+	this->ud->closeConnection();
+	this->ud = fresh;
+	return;
+}
+
+void Device_RicohAficio::udirGetEntries(const VC_ENTRYID& ids,
+	const VC_FIELD& fields, RowSink& sink
+)
+	throw (ECommFailure)
+{
+	stringArray *objectIdList = vectorToStringArray(this->ud.get(), ids);
+
+	VC_STRING propNames;
+	stringArray *selectProps = fieldsToSelectProps(this->ud.get(), fields,
+		propNames);
 
+	ud__getObjectsPropsResponse getObjectsPropsRes;
+	int ret;
+	this->ud->beginCall(uDirectoryClient::ReadCall);
+	do {
+		ret = this->ud->getObjectsProps(
+			idSession,
+			objectIdList,
+			selectProps,
+			NULL,//propertyList,
+			getObjectsPropsRes
+		);
+	} while (this->ud->retryCall(ret));
+	if (ret != SOAP_OK) {
+		std::cerr << "[udir] getObjectsProps() failed:" << std::endl;
+		this->ud->soap_stream_fault(std::cerr);
+		throw ECommFailure("SOAP error in getObjectsProps()");
+	}
 
+	propertyListArray *rows = getObjectsPropsRes.returnValue;
+	sink.reserve(rows->__size);
+	for (int i = 0; i < rows->__size; i++) sink.addRow(*rows->__ptr[i]);
+	return;
 }
 
-Device_RicohAficio::~Device_RicohAficio()
-	throw ()
+void Device_RicohAficio::setEntry(const EntryId& id, const FieldList& update)
+	throw (ECommFailure)
 {
-	this->udirCloseSession();
+	MP_UPDATE updates;
+	updates[id] = update;
+	this->applyBatch(updates);
+	return;
 }
 
-// Change the value of a metadata element.
-AddressBookPtr Device_RicohAficio::getAddressBook()
-	throw ()
+void Device_RicohAficio::applyBatch(const MP_UPDATE& updates,
+	BatchStats& stats
+)
+	throw (ECommFailure)
 {
-	return boost::static_pointer_cast<AddressBook>(shared_from_this());
+	VC_ENTRYID ids;
+	this->applyChanges(VC_ENTRYID(), updates, VC_FIELDLIST(), ids, stats);
+	return;
 }
 
-const AddressBook::VC_ENTRYID& Device_RicohAficio::getEntryIds()
+void Device_RicohAficio::createEntries(const VC_FIELDLIST& entries,
+	VC_ENTRYID& ids
+)
 	throw (ECommFailure)
 {
-	if (this->entryIds.empty()) {
-		VC_STRING fields;
-		fields.push_back(std::string("id"));
-		stringArray *addrObjectFields = vectorToStringArray(&this->ud, fields);
-		// TODO: get more than 50!
-		VC_RESULTS results;
-		this->udirSearch(addrObjectFields, "entry", "", 0, 50, results);
-
-		for (VC_RESULTS::iterator i = results.begin(); i != results.end(); i++) {
-			MP_PROPERTYLIST& object = *i;
-			//std::cout << "Addr book entry: " << object["id"] << std::endl;
-			unsigned long v = strtoul(object["id"].c_str(), NULL, 0);
-			if (v < 1<<30) {
-				std::string val("entry:");
-				val.append(object["id"]);
-				this->entryIds.push_back(val);
-				std::cout << "added " << val << std::endl;
-			}// else std::cout << "out of range: " << object["id"] <<std::endl;
-		}
-	}
-	return this->entryIds;
+	BatchStats stats;
+	this->applyChanges(VC_ENTRYID(), MP_UPDATE(), entries, ids, stats);
+	return;
 }
 
-AddressBook::FieldList Device_RicohAficio::getEntry(const EntryId& id)
+void Device_RicohAficio::deleteEntries(const VC_ENTRYID& ids)
 	throw (ECommFailure)
 {
-	throw ECommFailure("not implemented");
+	VC_ENTRYID newIds;
+	BatchStats stats;
+	this->applyChanges(ids, MP_UPDATE(), VC_FIELDLIST(), newIds, stats);
+	return;
 }
 
-void Device_RicohAficio::getEntries(const AddressBook::VC_ENTRYID& ids,
-	AddressBook::VC_FIELDLIST& results
+void Device_RicohAficio::applyChanges(const VC_ENTRYID& deletes,
+	const MP_UPDATE& updates, const VC_FIELDLIST& creates, VC_ENTRYID& ids,
+	BatchStats& stats
 )
 	throw (ECommFailure)
 {
-	stringArray *objectIdList = vectorToStringArray(&this->ud, ids);
-
-	stringArray selectProps;
-	std::string fields2[] = {"entryType", "id", "name", "longName",
-		/*"phoneticName", */"index",/* "passwordEncoding", "isDestination", "isSender",
-		"auth:", "auth:name", "auth:password", "password:", "password:password",
-		"password:usedForMailSender", "password:usedForRemoteFolder",
-		"password:passwordEncoding", "mail:", */"mail:address",/* "mail:parameter",
-		"mail:isDirectSMTP", "fax:", "fax:number", "fax:lineType", "fax:isAbroad",
-		"fax:parameter", "faxAux:", "faxAux:ttiNo", "faxAux:label1",
-		"faxAux:label2String", "faxAux:messageNo", "remoteFolder:",
-		"remoteFolder:type", "remoteFolder:serverName", "remoteFolder:path",
-		"remoteFolder:accountName", "remoteFolder:password", "remoteFolder:port",
-		"remoteFolder:characterEncoding", "remoteFolder:passwordEncoding",
-		"remoteFolder:select", "remoteFolder:logonMode",
-		"ldap:", "ldap:accountName", "ldap:password", "ldap:passwordEncoding",
-		"ldap:select",
-		"smtp:", "smtp:accountName", "smtp:password", "smtp:passwordEncoding",
-		"smtp:select",
-		"ifax:", "ifax:address", "ifax:parameter", "ifax:isDirectSMTP",*/
-		"tagId"
-	};
-	selectProps.__ptr = fields2;
-	selectProps.__size = sizeof(fields2) / sizeof(fields2[0]);
+	boost::recursive_mutex::scoped_lock lock(this->deviceLock);
+	if ((deletes.empty()) && (updates.empty()) && (creates.empty())) return;
 
-	ud__getObjectsPropsResponse getObjectsPropsRes;
-	if (this->ud.getObjectsProps(
-		idSession,
-		objectIdList,
-		&selectProps,
-		NULL,//propertyList,
-		getObjectsPropsRes
-	) != SOAP_OK) {
-		std::cerr << "[udir] getObjectsProps() failed:" << std::endl;
-		this->ud.soap_stream_fault(std::cerr);
-		throw ECommFailure("SOAP error in getObjectsProps()");
+	// Free earlier responses now, as udirRequireWriteSession() won't
+	this->releaseViews();
+
+	// Build every request before the address book is locked, so all that's
+	// left to do while it's locked is send them.  This also finds any bad
+	// fields without locking anything.
+	stringArray *deleteList = NULL;
+	if (!deletes.empty()) deleteList = vectorToStringArray(this->ud.get(), deletes);
+
+	typedef std::vector< std::pair<const EntryId *, propertyList *> > VC_REQUEST;
+	VC_REQUEST requests;
+	requests.reserve(updates.size());
+	for (MP_UPDATE::const_iterator i = updates.begin(); i != updates.end(); i++) {
+		// Only the fields given are sent, the rest of the entry is left alone
+		MP_PROPERTYLIST props;
+		fieldListToMap(i->second, props);
+		if (props.empty()) continue;
+		requests.push_back(std::make_pair(&i->first,
+			mapToPropertyList(this->ud.get(), props)));
 	}
+	propertyList *options = this->writeOptions();
 
-	propertyListArray *rows = getObjectsPropsRes.returnValue;
-	for (int i = 0; i < rows->__size; i++) {
-		propertyList *row = rows->__ptr[i];
-		AddressBook::FieldList fl;
-		for (int j = 0; j < row->__size; j++) {
-			std::string& propName = row->__ptr[j]->propName;
-			std::string& propVal = row->__ptr[j]->propVal;
-			std::map<std::string, AddressBook::Field>::iterator fi = this->fieldMap.find(propName);
-			if (fi != this->fieldMap.end()) {
-				fl[fi->second] = propVal;
-			} // else field isn't in the map, ignore it and keep going
+	propertyListArray *createList = NULL;
+	if (!creates.empty()) {
+		createList = soap_new_propertyListArray(this->ud.get(), -1);
+		createList->__size = creates.size();
+		createList->__ptr = (propertyList **)soap_malloc(this->ud.get(),
+			sizeof(propertyList *) * creates.size());
+		int j = 0;
+		for (VC_FIELDLIST::const_iterator i = creates.begin(); i != creates.end(); i++) {
+			MP_PROPERTYLIST props;
+			fieldListToMap(*i, props);
+			createList->__ptr[j++] = mapToPropertyList(this->ud.get(), props);
+		}
+	}
+	if ((!deleteList) && (requests.empty()) && (!createList)) return;
+
+	// Whatever happens below, cached copies can't be trusted any more
+	for (VC_ENTRYID::const_iterator i = deletes.begin(); i != deletes.end(); i++) {
+		this->entryCache.invalidate(*i);
+	}
+	for (VC_REQUEST::iterator i = requests.begin(); i != requests.end(); i++) {
+		this->entryCache.invalidate(*i->first);
+	}
+
+	// One session for the lot, rather than locking and unlocking the address
+	// book around every step
+	stats.lockWait += this->udirRequireWriteSession();
+	try {
+		// Delete first, in case the device is full
+		if (deleteList) this->udirDeleteEntries(deleteList);
+		for (VC_REQUEST::iterator i = requests.begin(); i != requests.end(); i++) {
+			this->setAddressBookEntry(*i->first, i->second, options);
+			stats.written++;
 		}
-		results.push_back(fl);
+		if (createList) this->udirCreateEntries(createList, creates.size(), ids);
+	} catch (const ECommFailure& e) {
+		stats.lockHeld += this->udirReleaseWriteSession();
+		throw;
 	}
+	stats.lockHeld += this->udirReleaseWriteSession();
 	return;
 }
 
-void Device_RicohAficio::setEntry(const EntryId& id, const FieldList& update)
+void Device_RicohAficio::udirRequireSession()
+	throw (ECommFailure)
+{
+	// Nothing from earlier calls is kept in the SOAP context, except what is
+	// being used by views, which become invalid now.
+	this->releaseViews();
+
+	if (this->sessionType != NoSession) return;
+
+	if (!this->udirOpenSession(SharedSession)) {
+		throw ECommFailure("Unable to log in - bad password?");
+	}
+	return;
+}
+
+double Device_RicohAficio::udirRequireWriteSession()
+	throw (ECommFailure)
+{
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	if (!this->udirReopenSession(ExclusiveSession, SESSION_TIMEOUT)) {
+		throw ECommFailure("Unable to get exclusive access to the address book");
+	}
+	gettimeofday(&this->writeLocked, NULL);
+	return elapsedSince(start);
+}
+
+double Device_RicohAficio::udirReleaseWriteSession()
 	throw (ECommFailure)
 {
-	throw ECommFailure("not implemented");
+	// The next read will open a shared session again, if there is one
+	if (this->sessionType != ExclusiveSession) return 0;
+	this->udirCloseSession();
+	return elapsedSince(this->writeLocked);
 }
 
-AddressBook::EntryId Device_RicohAficio::createEntry()
+void Device_RicohAficio::udirCheckProtocol()
 	throw (ECommFailure)
 {
-	throw ECommFailure("not implemented");
+	if (this->protocolVersion == 0) {
+		int ret;
+		this->ud->beginCall(uDirectoryClient::ReadCall);
+		do {
+			ret = this->ud->getProtocolVersion(this->protocolVersion);
+		} while (this->ud->retryCall(ret));
+		if (ret != SOAP_OK) {
+			this->protocolVersion = 0;
+			std::cerr << "Unable to contact device via HTTP/SOAP:" << std::endl;
+			this->ud->soap_stream_fault(std::cerr);
+			throw ECommFailure("Unable to contact device via HTTP/SOAP.");
+		}
+		if ((this->protocolVersion < 302) || (this->protocolVersion > 304)) {
+			std::cerr << "Warning: This device is using an unknown protocol version "
+				<< this->protocolVersion << std::endl;
+		}
+	}
+	return;
 }
 
 bool Device_RicohAficio::udirOpenSession(SessionType sessionType)
@@ -306,14 +1370,22 @@ bool Device_RicohAficio::udirOpenSession(SessionType sessionType)
 		"PES:Encoding=gwpwes003";
 	ud__startSessionResponse ssres;
 
+	this->udirCheckProtocol();
+
 	std::string sessionTypeString;
 	switch (sessionType) {
 		case SharedSession:    sessionTypeString = "S"; break;
 		case ExclusiveSession: sessionTypeString = "X"; break;
 	}
-	if (this->ud.startSession(
-		sessionInfo, SESSION_TIMEOUT, sessionTypeString, ssres
-	) != SOAP_OK) {
+	// A repeat could leave the first session holding the lock
+	int ret;
+	this->ud->beginCall(uDirectoryClient::WriteCall);
+	do {
+		ret = this->ud->startSession(
+			sessionInfo, SESSION_TIMEOUT, sessionTypeString, ssres
+		);
+	} while (this->ud->retryCall(ret));
+	if (ret != SOAP_OK) {
 		this->sessionType = NoSession;
 		throw ECommFailure("SOAP protocol error when logging in");
 	}
@@ -348,83 +1420,348 @@ bool Device_RicohAficio::udirReopenSession(SessionType sessionType, int timeout)
 void Device_RicohAficio::udirCloseSession()
 	throw (ECommFailure)
 {
+	if (this->sessionType == NoSession) return;
+
 	std::string status;
-	if (this->ud.terminateSession(this->idSession, status) != SOAP_OK) {
+	int ret;
+	this->ud->beginCall(uDirectoryClient::WriteCall);
+	do {
+		ret = this->ud->terminateSession(this->idSession, status);
+	} while (this->ud->retryCall(ret));
+	if (ret != SOAP_OK) {
 		std::cout << "[udir] Error closing session: " << std::endl;
-		this->ud.soap_stream_fault(std::cerr);
+		this->ud->soap_stream_fault(std::cerr);
 		throw ECommFailure("SOAP protocol error when attempting to close the session");
 	}
 	std::cout << "[udir] Close session: " << status << std::endl;
+	this->sessionType = NoSession;
+	this->idSession.clear();
+	return;
+}
+
+queryTermArray *Device_RicohAficio::udirQueryTerms(const Query::VC_TERM& terms)
+	throw (ECommFailure)
+{
+	if (terms.empty()) return NULL;
+
+	queryTermArray *qta = soap_new_queryTermArray(this->ud.get(), -1);
+	qta->__size = terms.size();
+	qta->__ptr = (itt__queryTerm **)soap_malloc(this->ud.get(),
+		sizeof(itt__queryTerm *) * terms.size());
+	int j = 0;
+	for (Query::VC_TERM::const_iterator i = terms.begin(); i != terms.end(); i++) {
+		const char *propName = fieldToPropName(i->field);
+		if (!propName) throw ECommFailure("This device cannot search on that field");
+		itt__queryTerm *qt = soap_new_itt__queryTerm(this->ud.get(), -1);
+		qt->operator_ = queryOperators[i->op];
+		qt->propName = propName;
+		qt->propVal = i->value;
+		qt->propVal2 = i->value2;
+		qta->__ptr[j++] = qt;
+	}
+	return qta;
+}
+
+void Device_RicohAficio::defaultFields(VC_FIELD& fields)
+	throw ()
+{
+	for (unsigned int i = 0; i < sizeof(entryFields) / sizeof(entryFields[0]); i++) {
+		Field f = this->atoms.field(this->atoms.atom(entryFields[i]));
+		if (f != FieldCount) fields.push_back(f);
+	}
 	return;
 }
 
-void Device_RicohAficio::udirSearch(stringArray *fields,
-	const std::string& fromClass, const std::string& parentObjectId, int start,
-	int count, VC_RESULTS& resultMap
+queryOrderByArray *Device_RicohAficio::udirOrderBy(const Query::VC_ORDER& order)
+	throw (ECommFailure)
+{
+	if (order.empty()) return NULL;
+
+	queryOrderByArray *qoa = soap_new_queryOrderByArray(this->ud.get(), -1);
+	qoa->__size = order.size();
+	qoa->__ptr = (itt__queryOrderBy **)soap_malloc(this->ud.get(),
+		sizeof(itt__queryOrderBy *) * order.size());
+	int j = 0;
+	for (Query::VC_ORDER::const_iterator i = order.begin(); i != order.end(); i++) {
+		const char *propName = fieldToPropName(i->field);
+		if (!propName) throw ECommFailure("This device cannot sort on that field");
+		itt__queryOrderBy *qo = soap_new_itt__queryOrderBy(this->ud.get(), -1);
+		qo->propName = propName;
+		qo->isDecending = i->descending;
+		qoa->__ptr[j++] = qo;
+	}
+	return qoa;
+}
+
+int Device_RicohAficio::udirSearch(stringArray *fields,
+	const std::string& fromClass, const std::string& parentObjectId,
+	const SearchCriteria& criteria, Cursor& cursor, int count,
+	RowSink& sink
 )
 	throw (ECommFailure)
 {
+	// Once we have a result set and know where we're up to, ask the device to
+	// continue on from the last object rather than skipping rows from the
+	// start of the query again.
+	bool keyset = (this->keysetPaging) && (!cursor.resultSetId.empty()) &&
+		(!cursor.lastId.empty());
+
 	ud__searchObjectsResponse searchRes;
-	if (this->ud.searchObjects(
-		this->idSession,
-		fields,
-		fromClass,
-		parentObjectId,
-		std::string(),
-		NULL,//whereAnd,
-		NULL,//whereOr,
-		NULL,//orderBy,
-		start,
-		count,
-		std::string(),
-		NULL,
-		searchRes
-	) != SOAP_OK) {
+	int ret;
+	this->ud->beginCall(uDirectoryClient::ReadCall);
+	do {
+		ret = this->ud->searchObjects(
+			this->idSession,
+			fields,
+			fromClass,
+			parentObjectId,
+			cursor.resultSetId,
+			criteria.whereAnd,
+			criteria.whereOr,
+			criteria.orderBy,
+			keyset ? 0 : cursor.position,
+			count,
+			keyset ? cursor.lastId : std::string(),
+			NULL,
+			searchRes
+		);
+	} while (this->ud->retryCall(ret));
+	if (ret != SOAP_OK) {
 		std::cerr << "[udir] searchObjects() failed:" << std::endl;
-		this->ud.soap_stream_fault(std::cerr);
+		this->ud->soap_stream_fault(std::cerr);
+		if (ret == SOAP_FAULT) {
+			throw ESearchRefused("Device refused searchObjects()");
+		}
 		throw ECommFailure("SOAP error in searchObjects()");
 	}
 
 	propertyListArray *rows = searchRes.rowList;
-	for (int i = 0; i < rows->__size; i++) {
-		propertyList *row = rows->__ptr[i];
-		MP_PROPERTYLIST pl;
-		for (int j = 0; j < row->__size; j++) {
-			pl[row->__ptr[j]->propName] = row->__ptr[j]->propVal;
+	int numRows = rows ? rows->__size : 0;
+
+	std::string firstId, lastId;
+	if (numRows > 0) {
+		const std::string *id = findProp(*rows->__ptr[0], "id");
+		if (id) firstId = fromClass + ":" + *id;
+		id = findProp(*rows->__ptr[numRows - 1], "id");
+		if (id) lastId = fromClass + ":" + *id;
+	}
+
+	if ((keyset) && (!firstId.empty()) && (firstId.compare(cursor.firstId) == 0)) {
+		// The device ignored lastObjectId and went back to the start, so fall
+		// back to using offsets from now on.
+		std::cerr << "[udir] Device does not support lastObjectId, using "
+			"rowOffset instead" << std::endl;
+		this->keysetPaging = false;
+		return this->udirSearch(fields, fromClass, parentObjectId, criteria,
+			cursor, count, sink);
+	}
+
+	// Only move the cursor on once the sink has taken every row, so a failure
+	// part way through doesn't leave it past rows that were never received.
+	for (int i = 0; i < numRows; i++) sink.addRow(*rows->__ptr[i]);
+
+	cursor.resultSetId = searchRes.resultSetId;
+	if (cursor.total < 0) cursor.total = searchRes.numOfResults;
+	if (cursor.position == 0) cursor.firstId = firstId;
+	cursor.lastId = lastId;
+	cursor.position += numRows;
+	if ((numRows == 0) || (cursor.position >= cursor.total)) cursor.finished = true;
+	return numRows;
+}
+
+void Device_RicohAficio::udirSearchPage(stringArray *fields,
+	const std::string& fromClass, const std::string& parentObjectId,
+	const SearchCriteria& criteria, Cursor& cursor, RowSink& sink
+)
+	throw (ECommFailure)
+{
+	for (;;) {
+		int count = this->pageSize;
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		int numRows;
+		try {
+			numRows = this->udirSearch(fields, fromClass, parentObjectId,
+				criteria, cursor, count, sink);
+		} catch (const ESearchRefused& e) {
+			// The device may be refusing a page this large, so try a smaller one
+			// before giving up.  Only stop growing back to this size if it is
+			// refused a second time, as the first may have been for another
+			// reason.
+			if (count <= PAGE_SIZE_MIN) throw;
+			if (count == this->pageRefused) {
+				this->pageSizeLimit = std::max(count / 2, PAGE_SIZE_MIN);
+			}
+			this->pageRefused = count;
+			this->pageSize = std::max(count / 2, PAGE_SIZE_MIN);
+			std::cerr << "[udir] Retrying search with " << this->pageSize
+				<< " rows per page" << std::endl;
+			continue;
 		}
-		resultMap.push_back(pl);
+		if (count >= this->pageRefused) this->pageRefused = 0;
+		double elapsed = elapsedSince(start);
+		if (cursor.finished) break;
+
+		if (numRows < count) {
+			// The device returned a short page without reaching the end, so this
+			// is the most it will return at once.
+			this->pageSizeLimit = std::max(numRows, PAGE_SIZE_MIN);
+			this->pageSize = this->pageSizeLimit;
+		} else {
+			double rowTime = elapsed / count;
+			if (
+				(this->pageRowTime > 0) &&
+				(rowTime > this->pageRowTime * PAGE_CLIFF_FACTOR)
+			) {
+				// The last increase made each row slower, so go back to the previous
+				// size and stay there.
+				this->pageSizeLimit = std::max(count / 2, PAGE_SIZE_MIN);
+				this->pageSize = this->pageSizeLimit;
+			} else {
+				this->pageRowTime = rowTime;
+				this->pageSize = std::min(count * 2, this->pageSizeLimit);
+			}
+		}
+		break;
 	}
 	return;
 }
 
-void Device_RicohAficio::setAddressBookEntry(const std::string& id,
-	MP_PROPERTYLIST update
+void Device_RicohAficio::udirSearchAll(stringArray *fields,
+	const std::string& fromClass, const std::string& parentObjectId,
+	const SearchCriteria& criteria, RowSink& sink
 )
 	throw (ECommFailure)
 {
-	//MP_PROPERTYLIST update;
-	//update["mail:address"] = "itadmin@research.uq.edu.au";
-	MP_PROPERTYLIST options;
-	options["replaceAll"] = "false";
+	Cursor cursor;
+	bool first = true;
+	do {
+		this->udirSearchPage(fields, fromClass, parentObjectId, criteria, cursor,
+			sink);
+		// Now we know how big the result is, allocate it all at once
+		if (first) sink.reserve(cursor.total);
+		first = false;
+	} while (!cursor.finished);
+	return;
+}
 
-	propertyList *updateList = mapToPropertyList(&this->ud, update);
-	propertyList *optionsList = mapToPropertyList(&this->ud, options);
+void Device_RicohAficio::setAddressBookEntry(const std::string& id,
+	propertyList *update, propertyList *options
+)
+	throw (ECommFailure)
+{
+	// This is only sent just after opening the session or another update, so
+	// the connection won't have been idle long enough for the device to close
+	// it.
 	std::string resPut;
-	if (this->ud.putObjectProps(
-		idSession,
-		std::string("entry:107"),
-		updateList,
-		optionsList,
-		resPut
-	) != SOAP_OK) {
+	int ret;
+	this->ud->beginCall(uDirectoryClient::FollowOnCall);
+	do {
+		ret = this->ud->putObjectProps(
+			idSession,
+			id,
+			update,
+			options,
+			resPut
+		);
+	} while (this->ud->retryCall(ret));
+	if (ret != SOAP_OK) {
 		std::cerr << "[udir] putObjectProps() failed:" << std::endl;
-		this->ud.soap_stream_fault(std::cerr);
+		this->ud->soap_stream_fault(std::cerr);
 		// This can happen when attempting an update and udir has been opened
 		// in shared/readonly mode.
 		throw ECommFailure("SOAP protocol error when attempting an update");
 	}
-	std::cout << "[udir] Update result: " << resPut << std::endl;
+	if (resPut.compare("OK") != 0) {
+		throw ECommFailure("Device refused to update the entry: " + resPut);
+	}
+	return;
+}
+
+propertyList *Device_RicohAficio::writeOptions()
+	throw ()
+{
+	// Leave any properties not being written alone
+	MP_PROPERTYLIST options;
+	options["replaceAll"] = "false";
+	return mapToPropertyList(this->ud.get(), options);
+}
+
+void Device_RicohAficio::udirCreateEntries(propertyListArray *entries,
+	unsigned int count, VC_ENTRYID& ids
+)
+	throw (ECommFailure)
+{
+	// A repeat would create the entries twice
+	ud__putObjectsResponse putObjectsRes;
+	int ret;
+	this->ud->beginCall(uDirectoryClient::WriteCall);
+	do {
+		ret = this->ud->putObjects(
+			idSession,
+			"entry",
+			"",
+			entries,
+			NULL,
+			putObjectsRes
+		);
+	} while (this->ud->retryCall(ret));
+	// The list of IDs is out of date now, even if the reply was lost
+	this->entryIds.clear();
+	if (ret != SOAP_OK) {
+		std::cerr << "[udir] putObjects() failed:" << std::endl;
+		this->ud->soap_stream_fault(std::cerr);
+		throw ECommFailure("SOAP error in putObjects()");
+	}
+	if (putObjectsRes.returnValue.compare("OK") != 0) {
+		throw ECommFailure("Device refused to create the entries: "
+			+ putObjectsRes.returnValue);
+	}
+
+	// Every ID is needed to match them up with the entries, so don't return
+	// any of them unless they are all there
+	stringArray *objectIds = putObjectsRes.objectIdList;
+	unsigned int numIds = objectIds ? objectIds->__size : 0;
+	if (numIds != count) {
+		throw ECommFailure("Device did not return an ID for each new entry");
+	}
+	VC_ENTRYID newIds(numIds);
+	for (unsigned int i = 0; i < numIds; i++) {
+		if (!objectIdToEntryId(objectIds->__ptr[i], newIds[i])) {
+			throw ECommFailure("Device returned an invalid ID for a new entry: "
+				+ objectIds->__ptr[i]);
+		}
+		// The ID may have belonged to a deleted entry that is still cached
+		this->entryCache.invalidate(newIds[i]);
+	}
+	ids.insert(ids.end(), newIds.begin(), newIds.end());
+	return;
+}
 
+void Device_RicohAficio::udirDeleteEntries(stringArray *objectIds)
+	throw (ECommFailure)
+{
+	// A repeat would report entries deleted the first time as missing
+	std::string resDelete;
+	int ret;
+	this->ud->beginCall(uDirectoryClient::WriteCall);
+	do {
+		ret = this->ud->deleteObjects(
+			idSession,
+			objectIds,
+			NULL,
+			resDelete
+		);
+	} while (this->ud->retryCall(ret));
+	this->entryIds.clear();
+	if (ret != SOAP_OK) {
+		std::cerr << "[udir] deleteObjects() failed:" << std::endl;
+		this->ud->soap_stream_fault(std::cerr);
+		throw ECommFailure("SOAP error in deleteObjects()");
+	}
+	if (resDelete.compare("OK") != 0) {
+		throw ECommFailure("Device refused to delete the entries: " + resDelete);
+	}
 	return;
 }
 
@@ -21,12 +21,20 @@
 #ifndef _LIBMFD_DEVICE_RICOH_AFICIO_HPP_
 #define _LIBMFD_DEVICE_RICOH_AFICIO_HPP_
 
+#include <sys/time.h>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 
 #include <libmfd/addressbook.hpp>
+#include <libmfd/columns.hpp>
 #include <libmfd/device.hpp>
 #include <libmfd/devicetype.hpp>
+#include <libmfd/query.hpp>
+#include <libmfd/view.hpp>
 
+#include "batcher.hpp"
+#include "entrycache.hpp"
+#include "singleflight.hpp"
 #include "soapuDirectoryProxy.h"
 
 namespace mfd {
@@ -42,6 +50,355 @@ enum SessionType {
 	ExclusiveSession,   // allow updates
 };
 
+/// Optional filtering for a uDirectory search.
+struct SearchCriteria {
+	queryTermArray *whereAnd;  ///< Terms that must all match, or NULL
+	queryTermArray *whereOr;   ///< Terms of which one must match, or NULL
+	queryOrderByArray *orderBy;  ///< Sort order, or NULL for the default
+
+	SearchCriteria()
+		throw ();
+};
+
+/// Interned uDirectory property names.
+/**
+ * Each property name is given a small integer (an atom) the first time it is
+ * seen, along with the AddressBook::Field it corresponds to, if any.  Every
+ * row of a result lists the same properties, usually in the same order, so
+ * atomAt() can normally confirm a property with a single string comparison
+ * instead of copying the name or looking it up in a map.
+ */
+class PropertyAtoms {
+
+	public:
+		typedef int Atom;
+
+		/// Atom of the "id" property.
+		static const Atom IdAtom = 0;
+
+		/// Set up atoms for every known address book property.
+		PropertyAtoms()
+			throw ();
+
+		/// Get the atom for a property name, creating one if needed.
+		Atom atom(const std::string& name)
+			throw ();
+
+		/// Get the atom for a property at a given position in a row.
+		/**
+		 * This is the same as atom(), but faster when the property is in the
+		 * same position as in the previous row.
+		 */
+		Atom atomAt(unsigned int position, const std::string& name)
+			throw ();
+
+		/// Get the address book field for an atom.
+		/**
+		 * @return The field, or AddressBook::FieldCount if the property is not
+		 *   an address book field.
+		 */
+		AddressBook::Field field(Atom atom) const
+			throw ()
+		{
+			return this->fields[atom];
+		}
+
+	protected:
+		std::map<std::string, Atom> index;      ///< Atom for each name
+		std::vector<std::string> names;         ///< Name for each atom
+		std::vector<AddressBook::Field> fields; ///< Field for each atom
+		std::vector<Atom> lastRow;              ///< Atoms in the last row seen
+
+};
+
+/// The device returned a fault in response to a search.
+/**
+ * This is kept apart from other failures because the device answers this
+ * way when asked for more rows than it is willing to return at once, so
+ * the search may succeed with a smaller page.
+ */
+class ESearchRefused: public ECommFailure {
+	public:
+		ESearchRefused(const std::string& msg);
+};
+
+/// Receives the rows of a uDirectory search as they arrive.
+class RowSink {
+
+	public:
+		virtual ~RowSink()
+			throw ();
+
+		/// Called once the total number of rows is known.
+		virtual void reserve(int rows)
+			throw () = 0;
+
+		/// Called for each row in the order they were returned.
+		virtual void addRow(const propertyList& row)
+			throw (ECommFailure) = 0;
+
+};
+
+/// RowSink that collects the entry ID of each row.
+class IdsSink: public RowSink {
+
+	public:
+		IdsSink(AddressBook::VC_ENTRYID& ids, PropertyAtoms& atoms)
+			throw ();
+
+		virtual void reserve(int rows)
+			throw ();
+
+		virtual void addRow(const propertyList& row)
+			throw (ECommFailure);
+
+	protected:
+		AddressBook::VC_ENTRYID& ids;
+		PropertyAtoms& atoms;
+
+};
+
+/// RowSink that copies each address book entry into a Record.
+class RecordsSink: public RowSink {
+
+	public:
+		/**
+		 * @param  records  Entries are appended to this list.
+		 * @param  atoms    Property names seen so far.
+		 * @param  ids      If not NULL, each entry's ID is appended to this list.
+		 * @param  entriesOnly  true to skip rows which aren't normal entries.
+		 */
+		RecordsSink(AddressBook::VC_RECORD& records, PropertyAtoms& atoms,
+			AddressBook::VC_ENTRYID *ids, bool entriesOnly)
+			throw ();
+
+		virtual void reserve(int rows)
+			throw ();
+
+		virtual void addRow(const propertyList& row)
+			throw (ECommFailure);
+
+	protected:
+		AddressBook::VC_RECORD& records;
+		PropertyAtoms& atoms;
+		AddressBook::VC_ENTRYID *ids;
+		bool entriesOnly;
+
+};
+
+/// RowSink that copies each address book entry straight into EntryColumns.
+class ColumnsSink: public RowSink {
+
+	public:
+		ColumnsSink(EntryColumns& columns, PropertyAtoms& atoms)
+			throw ();
+
+		virtual void reserve(int rows)
+			throw ();
+
+		virtual void addRow(const propertyList& row)
+			throw (ECommFailure);
+
+	protected:
+		EntryColumns& columns;
+		PropertyAtoms& atoms;
+
+};
+
+class uDirectoryClient;
+
+/// EntryView over the rows of a uDirectory response.
+/**
+ * As each row arrives (as a RowSink) a pointer to the value of each requested
+ * field is kept, so nothing is copied out of the SOAP context.  The view holds
+ * a reference to the client owning that context, and the device won't free it
+ * while any view still holds one.
+ */
+class EntryView_RicohAficio: public EntryView, public RowSink {
+
+	public:
+		/**
+		 * @param  fields  Fields to keep for each row.
+		 * @param  atoms   Property names seen so far.
+		 * @param  response  Client whose SOAP context the rows are read into.
+		 * @param  entriesOnly  true to skip rows which aren't normal entries.
+		 */
+		EntryView_RicohAficio(const AddressBook::VC_FIELD& fields,
+			PropertyAtoms& atoms, boost::shared_ptr<uDirectoryClient> response,
+			bool entriesOnly)
+			throw ();
+
+		virtual ~EntryView_RicohAficio()
+			throw ();
+
+		virtual bool valid() const
+			throw ();
+
+		virtual unsigned int size() const
+			throw ();
+
+		virtual bool has(unsigned int row, AddressBook::Field field) const
+			throw ();
+
+		virtual StringRef get(unsigned int row, AddressBook::Field field) const
+			throw ();
+
+		virtual void reserve(int rows)
+			throw ();
+
+		virtual void addRow(const propertyList& row)
+			throw (ECommFailure);
+
+	protected:
+		PropertyAtoms& atoms;
+		boost::shared_ptr<uDirectoryClient> response; ///< owns the cells' memory
+		bool entriesOnly;
+		unsigned int numRows;
+
+		/// Index of each field within a row of cells, or -1 if not kept.
+		int column[AddressBook::FieldCount];
+
+		/// Number of fields kept for each row.
+		unsigned int numColumns;
+
+		/// Each row's values, NULL where the row doesn't have the field.
+		std::vector<const std::string *> cells;
+
+		/// Get a cell, or NULL if the field is not set in that row.
+		const std::string *cell(unsigned int row, AddressBook::Field field) const
+			throw ()
+		{
+			if ((row >= this->numRows) || (field >= AddressBook::FieldCount)) {
+				return NULL;
+			}
+			int c = this->column[field];
+			if (c < 0) return NULL;
+			return this->cells[row * this->numColumns + c];
+		}
+
+};
+
+/// uDirectory SOAP client that keeps its HTTP connection open between calls.
+/**
+ * The embedded web server in these devices is slow to accept new connections,
+ * so a single HTTP/1.1 keep-alive connection is reused for every call.  If the
+ * device closes the connection while it's idle, the next call will fail and
+ * retryCall() will arrange for it to be resent on a new connection.
+ *
+ * Only calls that are safe to repeat are resent, as the device may have
+ * carried out the call and then lost the connection before replying.  Each
+ * call is made the same way, with only its CallType saying which it is:
+ *
+ * @code
+ * int ret;
+ * ud->beginCall(uDirectoryClient::ReadCall);
+ * do {
+ *     ret = ud->getProtocolVersion(version);
+ * } while (ud->retryCall(ret));
+ * @endcode
+ */
+class uDirectoryClient: public uDirectoryProxy {
+
+	public:
+		/// Whether a call is safe to send again.
+		enum CallType {
+			ReadCall,     ///< Only reads, so resent if the connection had dropped
+			WriteCall,    ///< Changes something, so sent once on a new connection
+			FollowOnCall  ///< Changes something, sent once straight after another
+		};
+
+		/// Connection counters, updated as requests are sent.
+		ConnectionStats stats;
+
+		/**
+		 * @param  hostname  The device hostname or IP address.
+		 */
+		uDirectoryClient(const std::string& hostname)
+			throw ();
+
+		/// Get ready to send a call.
+		/**
+		 * A WriteCall closes the connection first, so the call isn't sent over
+		 * one the device may have already closed.
+		 */
+		void beginCall(CallType type)
+			throw ();
+
+		/// Decide whether the call just made should be repeated.
+		/**
+		 * @param  ret  Value returned by the uDirectoryProxy function.
+		 *
+		 * @return true if a ReadCall was sent over a reused connection that the
+		 *         device had closed, in which case the connection has been reset
+		 *         and the call should be repeated.  false if the call worked, was
+		 *         a genuine error, or isn't safe to repeat.
+		 */
+		bool retryCall(int ret)
+			throw ();
+
+		/// Free everything gSOAP has allocated for previous calls.
+		void release()
+			throw ();
+
+		/// Close the connection, so the next call opens a new one.
+		void closeConnection()
+			throw ();
+
+	protected:
+		/// URL of the uDirectory service, soap_endpoint points into this.
+		std::string endpoint;
+
+		/// Type of the call being made, from beginCall().
+		CallType callType;
+
+		/// true if a new connection has been opened since the last request.
+		bool freshConnection;
+
+		/// true if the last request was sent over an existing connection.
+		bool reusedConnection;
+
+		/// gSOAP's original connect callback.
+		SOAP_SOCKET (*fopenDefault)(struct soap *soap, const char *endpoint,
+			const char *host, int port);
+
+		/// gSOAP's original HTTP POST callback.
+		int (*fpostDefault)(struct soap *soap, const char *endpoint,
+			const char *host, int port, const char *path, const char *action,
+			size_t count);
+
+		/// Connect callback, counts new connections.
+		static SOAP_SOCKET fopenCount(struct soap *soap, const char *endpoint,
+			const char *host, int port);
+
+		/// HTTP POST callback, counts requests.
+		static int fpostCount(struct soap *soap, const char *endpoint,
+			const char *host, int port, const char *path, const char *action,
+			size_t count);
+
+};
+
+/// Shared pointer to a uDirectoryClient.
+typedef boost::shared_ptr<uDirectoryClient> uDirectoryClientPtr;
+
+/// Result of probing a Ricoh device, holding the connection used.
+/**
+ * The uDirectory protocol version is stored in details["protocolVersion"].
+ */
+class DeviceProbe_RicohAficio: virtual public DeviceProbe {
+
+	public:
+		/// Client used for the probe, handed over to the Device on open().
+		uDirectoryClientPtr client;
+
+		DeviceProbe_RicohAficio(const std::string& hostname,
+			E_CERTAINTY certainty, uDirectoryClientPtr client)
+			throw ();
+
+		virtual ~DeviceProbe_RicohAficio()
+			throw ();
+
+};
+
 class DeviceType_RicohAficio: virtual public DeviceType {
 
 	public:
@@ -52,34 +409,74 @@ class DeviceType_RicohAficio: virtual public DeviceType {
 		virtual std::string getFriendlyName() const
 			throw ();
 
-		virtual E_CERTAINTY isInstance(const std::string& hostname) const
+		virtual E_CERTAINTY isInstance(const std::string& hostname,
+			int timeout = 0) const
+			throw (std::ios::failure);
+
+		virtual DeviceProbePtr probe(const std::string& hostname,
+			int timeout = 0) const
 			throw (std::ios::failure);
 
 		virtual DevicePtr open(const std::string& hostname,
 			const std::string& username, const std::string& password) const
 			throw (ECommFailure);
 
+		virtual DevicePtr open(DeviceProbePtr probe,
+			const std::string& username, const std::string& password) const
+			throw (ECommFailure);
+
 };
 
+/// Ricoh Aficio device, accessed through its uDirectory SOAP service.
+/**
+ * @note Multithreading: Functions may be called from any number of threads.
+ *       Requests to the device are made one at a time, and identical reads
+ *       made at the same time share one request.  An EntryView stays valid
+ *       until it is destroyed, whichever thread makes the next call.
+ */
 class Device_RicohAficio: virtual public Device, virtual public AddressBook,
 	public boost::enable_shared_from_this<Device_RicohAficio>
 {
 	protected:
 		std::string hostname;
-		uDirectoryProxy ud;
+		std::string username;
+		std::string password;
+		uDirectoryClientPtr ud;
+		int protocolVersion;      ///< 0 until first retrieved from the device
 		SessionType sessionType;
 		std::string idSession;
-		std::map<std::string, AddressBook::Field> fieldMap;
+		struct timeval writeLocked; ///< when the exclusive session was opened
+		PropertyAtoms atoms;      ///< property names seen in results
+		VersionInfo versionInfo;  ///< empty until first requested
+		int pageSize;             ///< number of rows to request per search page
+		int pageSizeLimit;        ///< largest page size known to work well
+		double pageRowTime;       ///< seconds per row at the last good page size
+		int pageRefused;          ///< page size last refused, 0 if none since
+		bool keysetPaging;        ///< false if the device ignores lastObjectId
 
 		// AddressBook
 		VC_ENTRYID entryIds;
+		EntryCache entryCache;    ///< entries returned by getEntry()
+
+		/// Held while using ud, as it can only make one request at a time.
+		mutable boost::recursive_mutex deviceLock;
+
+		/// getEntry() requests in progress.
+		SingleFlight<EntryId, FieldList> entryFetches;
+
+		/// Combines getEntry() requests from different threads, if enabled.
+		LookupBatcher lookups;
 
 	public:
 		/**
-		 * @throws std::ios::failure if the device couldn't be contacted via HTTP
+		 * @param  probe  Optional result of an earlier probe.  Its connection (if
+		 *   any) is taken over, and its protocol version and version information
+		 *   are used instead of asking the device again.
+		 *
+		 * @note No connection is made to the device until it is first used.
 		 */
 		Device_RicohAficio(const std::string& hostname, const std::string& username,
-			const std::string& password)
+			const std::string& password, DeviceProbePtr probe = DeviceProbePtr())
 			throw (ECommFailure);
 
 		~Device_RicohAficio()
@@ -88,28 +485,115 @@ class Device_RicohAficio: virtual public Device, virtual public AddressBook,
 		AddressBookPtr getAddressBook()
 			throw ();
 
+		ConnectionStats getConnectionStats() const
+			throw ();
+
+		const VersionInfo& getVersionInfo()
+			throw (ECommFailure);
+
 		// AddressBook functions
 
-		virtual const VC_ENTRYID& getEntryIds()
+		virtual const char *getFieldName(Field field) const
+			throw ();
+
+		virtual VC_ENTRYID getEntryIds()
+			throw (ECommFailure);
+
+		virtual void scanEntryIds(Cursor& cursor, VC_ENTRYID& ids)
+			throw (ECommFailure);
+
+		virtual void scanEntries(Cursor& cursor, const VC_FIELD& fields,
+			VC_ENTRYID& ids, VC_RECORD& results)
+			throw (ECommFailure);
+
+		using AddressBook::getAllEntries;
+		virtual void getAllEntries(const VC_FIELD& fields, VC_RECORD& results)
+			throw (ECommFailure);
+
+		virtual void getAllEntries(EntryColumns& results)
+			throw (ECommFailure);
+
+		using AddressBook::find;
+		virtual void find(const Query& query, VC_RECORD& results)
 			throw (ECommFailure);
 
 		/// Get details for a given entry ID.
 		virtual FieldList getEntry(const EntryId& id)
 			throw (ECommFailure);
 
+		virtual void setEntryCache(unsigned int maxEntries, int ttl)
+			throw ();
+
+		virtual void setEntryBatching(unsigned int maxEntries, int window)
+			throw ();
+
+		virtual CacheStats getEntryCacheStats() const
+			throw ();
+
 		/// Get details for multiple entry IDs in one operation.
-		virtual void getEntries(const VC_ENTRYID& ids, VC_FIELDLIST& results)
+		using AddressBook::getEntries;
+		virtual void getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			VC_RECORD& results)
+			throw (ECommFailure);
+		virtual void getEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			VC_ENTRYID& found, VC_RECORD& results)
 			throw (ECommFailure);
 
 		/// Set details for an entry ID.
 		virtual void setEntry(const EntryId& id, const FieldList& update)
 			throw (ECommFailure);
 
-		/// Add a new entry ID.
-		virtual EntryId createEntry()
+		virtual EntryViewPtr viewAllEntries(const VC_FIELD& fields)
+			throw (ECommFailure);
+
+		virtual EntryViewPtr viewEntries(const VC_ENTRYID& ids,
+			const VC_FIELD& fields)
+			throw (ECommFailure);
+
+		virtual void releaseViews()
+			throw ();
+
+		/// Set details for many entries in one exclusive session.
+		using AddressBook::applyBatch;
+		virtual void applyBatch(const MP_UPDATE& updates, BatchStats& stats)
+			throw (ECommFailure);
+
+		/// Add new entries in one operation.
+		virtual void createEntries(const VC_FIELDLIST& entries, VC_ENTRYID& ids)
+			throw (ECommFailure);
+
+		/// Remove entries in one operation.
+		virtual void deleteEntries(const VC_ENTRYID& ids)
+			throw (ECommFailure);
+
+		virtual void applyChanges(const VC_ENTRYID& deletes,
+			const MP_UPDATE& updates, const VC_FIELDLIST& creates,
+			VC_ENTRYID& ids, BatchStats& stats)
 			throw (ECommFailure);
 
 	protected:
+		/// Make sure a session is open, opening a shared one if not.
+		/**
+		 * This is called at the start of any function that needs a session, so
+		 * the device isn't contacted until it is actually needed.  It also frees
+		 * the responses to earlier calls, invalidating any views.
+		 *
+		 * @throws ECommFailure if the device can't be contacted or the login
+		 *         fails.
+		 */
+		void udirRequireSession()
+			throw (ECommFailure);
+
+		/// Retrieve the protocol version, if it hasn't been already.
+		/**
+		 * This is the first request sent to a device, so it is also where an
+		 * unreachable device is reported.
+		 *
+		 * @throws ECommFailure if the device can't be contacted.
+		 */
+		void udirCheckProtocol()
+			throw (ECommFailure);
+
 		/// Open a uDirectory session.
 		/**
 		 * @return true on success, false on bad password.
@@ -129,15 +613,131 @@ class Device_RicohAficio: virtual public Device, virtual public AddressBook,
 		void udirCloseSession()
 			throw (ECommFailure);
 
-		void udirSearch(stringArray *fields, const std::string& fromClass,
-			const std::string& parentObjectId, int start, int count,
-			VC_RESULTS& resultMap)
+		/// Make sure an exclusive session is open, so entries can be changed.
+		/**
+		 * This locks everyone else out of the address book, including the
+		 * device's front panel, so everything to be written should be prepared
+		 * beforehand and udirReleaseWriteSession() called as soon as the write
+		 * is done.
+		 *
+		 * Unlike udirRequireSession() this leaves the SOAP context alone, so
+		 * requests built in it beforehand can still be sent.
+		 *
+		 * @return Seconds spent waiting for the session.
+		 *
+		 * @throws ECommFailure if exclusive access isn't granted within
+		 *         SESSION_TIMEOUT seconds.
+		 */
+		double udirRequireWriteSession()
+			throw (ECommFailure);
+
+		/// Give up the exclusive session opened by udirRequireWriteSession().
+		/**
+		 * @return Seconds the exclusive session was held for.
+		 */
+		double udirReleaseWriteSession()
+			throw (ECommFailure);
+
+		/// Retrieve one page of search results.
+		/**
+		 * Results are passed to sink and cursor is moved past them.  fields
+		 * should include "id", otherwise each page will have to be located by
+		 * offset from the start of the result set.
+		 *
+		 * @return Number of rows returned, which may be less than count.
+		 */
+		int udirSearch(stringArray *fields, const std::string& fromClass,
+			const std::string& parentObjectId, const SearchCriteria& criteria,
+			Cursor& cursor, int count, RowSink& sink)
+			throw (ECommFailure);
+
+		/// Retrieve one page of search results, adjusting the page size.
+		/**
+		 * The page size is adjusted as we go, growing until the device either
+		 * rejects the request, returns fewer rows than asked for, or takes
+		 * disproportionately longer per row.  What is learned is kept for later
+		 * searches on this device.
+		 */
+		void udirSearchPage(stringArray *fields, const std::string& fromClass,
+			const std::string& parentObjectId, const SearchCriteria& criteria,
+			Cursor& cursor, RowSink& sink)
+			throw (ECommFailure);
+
+		/// Retrieve every search result, as many pages as it takes.
+		void udirSearchAll(stringArray *fields, const std::string& fromClass,
+			const std::string& parentObjectId, const SearchCriteria& criteria,
+			RowSink& sink)
+			throw (ECommFailure);
+
+		/// Convert Query terms into a uDirectory queryTermArray.
+		/**
+		 * The result is allocated in the SOAP context and freed along with it.
+		 *
+		 * @return The converted terms, or NULL if terms is empty.
+		 * @throws ECommFailure if a term uses a field the device doesn't have.
+		 */
+		queryTermArray *udirQueryTerms(const Query::VC_TERM& terms)
+			throw (ECommFailure);
+
+		/// Convert Query sort keys into a uDirectory queryOrderByArray.
+		/**
+		 * @return The converted sort keys, or NULL if order is empty.
+		 * @throws ECommFailure if a key uses a field the device doesn't have.
+		 */
+		queryOrderByArray *udirOrderBy(const Query::VC_ORDER& order)
+			throw (ECommFailure);
+
+		/// Retrieve an entry for getEntry() and add it to the cache.
+		FieldList fetchEntry(const EntryId& id)
+			throw (ECommFailure);
+
+		/// Retrieve a batch of entries for lookups and add them to the cache.
+		void fetchEntries(const VC_ENTRYID& ids, LookupBatcher::MP_ENTRY& entries)
+			throw (ECommFailure);
+
+		/// Get the fields retrieved when the caller doesn't list any.
+		void defaultFields(VC_FIELD& fields)
+			throw ();
+
+		/// Get the details for entry IDs from the device.
+		/**
+		 * @param  ids     Entries to retrieve.
+		 * @param  fields  Fields to retrieve for each entry.
+		 * @param  sink    Receives each entry.
+		 */
+		void udirGetEntries(const VC_ENTRYID& ids, const VC_FIELD& fields,
+			RowSink& sink)
 			throw (ECommFailure);
 
 		void getAddressBookEntries(const VC_STRING& ids, VC_RESULTS& results)
 			throw (ECommFailure);
 
-		void setAddressBookEntry(const std::string& id, MP_PROPERTYLIST update)
+		/// Change some properties of an object.  An exclusive session must be open.
+		/**
+		 * @param  id       Object to change.
+		 * @param  update   Properties to change.
+		 * @param  options  putObjectProps options, from writeOptions().
+		 */
+		void setAddressBookEntry(const std::string& id, propertyList *update,
+			propertyList *options)
+			throw (ECommFailure);
+
+		/// Options for setAddressBookEntry(), allocated in the SOAP context.
+		propertyList *writeOptions()
+			throw ();
+
+		/// Add new entries.  The caller must hold the exclusive session.
+		/**
+		 * @param  entries  Request built from the new entries.
+		 * @param  count    Number of new entries.
+		 * @param  ids      The ID of each new entry is appended here.
+		 */
+		void udirCreateEntries(propertyListArray *entries, unsigned int count,
+			VC_ENTRYID& ids)
+			throw (ECommFailure);
+
+		/// Remove entries.  The caller must hold the exclusive session.
+		void udirDeleteEntries(stringArray *objectIds)
 			throw (ECommFailure);
 
 };
@@ -0,0 +1,134 @@
+/**
+ * @file   entrycache.cpp
+ * @brief  EntryCache class, keeping recently used address book entries.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "entrycache.hpp"
+
+namespace mfd {
+
+EntryCache::EntryCache(unsigned int maxEntries, int ttl)
+	throw () :
+		maxEntries(maxEntries),
+		ttl(ttl)
+{
+}
+
+bool EntryCache::lookup(const AddressBook::EntryId& id,
+	AddressBook::FieldList& entry
+)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	MP_ITEM::iterator i = this->items.find(id);
+	if (i == this->items.end()) {
+		this->stats.misses++;
+		return false;
+	}
+	if (time(NULL) >= i->second.expires) {
+		this->erase(i);
+		this->stats.misses++;
+		return false;
+	}
+	// Move to the front, so it is the last to be dropped
+	this->recent.splice(this->recent.begin(), this->recent, i->second.lru);
+	entry = i->second.entry;
+	this->stats.hits++;
+	return true;
+}
+
+void EntryCache::store(const AddressBook::EntryId& id,
+	const AddressBook::FieldList& entry
+)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	if (this->maxEntries == 0) return;
+
+	MP_ITEM::iterator i = this->items.find(id);
+	if (i == this->items.end()) {
+		this->trim(this->maxEntries - 1);
+		this->recent.push_front(id);
+		i = this->items.insert(MP_ITEM::value_type(id, Item())).first;
+	} else {
+		this->recent.erase(i->second.lru);
+		this->recent.push_front(id);
+	}
+	i->second.entry = entry;
+	i->second.expires = time(NULL) + this->ttl;
+	i->second.lru = this->recent.begin();
+	return;
+}
+
+void EntryCache::invalidate(const AddressBook::EntryId& id)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	MP_ITEM::iterator i = this->items.find(id);
+	if (i != this->items.end()) this->erase(i);
+	return;
+}
+
+void EntryCache::clear()
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	this->items.clear();
+	this->recent.clear();
+	return;
+}
+
+void EntryCache::setLimits(unsigned int maxEntries, int ttl)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	this->maxEntries = maxEntries;
+	this->ttl = ttl;
+	this->trim(maxEntries);
+	return;
+}
+
+AddressBook::CacheStats EntryCache::getStats() const
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	AddressBook::CacheStats stats = this->stats;
+	stats.size = this->items.size();
+	return stats;
+}
+
+void EntryCache::trim(unsigned int max)
+	throw ()
+{
+	while (this->items.size() > max) {
+		this->items.erase(this->recent.back());
+		this->recent.pop_back();
+		this->stats.evictions++;
+	}
+	return;
+}
+
+void EntryCache::erase(MP_ITEM::iterator i)
+	throw ()
+{
+	this->recent.erase(i->second.lru);
+	this->items.erase(i);
+	return;
+}
+
+} // namespace mfd
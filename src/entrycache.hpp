@@ -0,0 +1,114 @@
+/**
+ * @file   entrycache.hpp
+ * @brief  EntryCache class, keeping recently used address book entries.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_ENTRYCACHE_HPP_
+#define _LIBMFD_ENTRYCACHE_HPP_
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <boost/thread/mutex.hpp>
+
+#include <libmfd/addressbook.hpp>
+
+namespace mfd {
+
+/// Recently used address book entries, held in memory for a limited time.
+/**
+ * Once the cache is full, the entry that has gone longest without being
+ * looked up is dropped to make room.  Entries are also dropped once they are
+ * older than the TTL, so a lookup never returns anything older than that.
+ *
+ * @note Multithreading: Any function may be called from any thread.
+ */
+class EntryCache {
+
+	public:
+		/**
+		 * @param  maxEntries  Largest number of entries to keep, or 0 to keep
+		 *   nothing.
+		 * @param  ttl  Seconds an entry is kept for.
+		 */
+		EntryCache(unsigned int maxEntries, int ttl)
+			throw ();
+
+		/// Look up an entry.
+		/**
+		 * @param  id     Entry to look up.
+		 * @param  entry  On success, set to the cached details.
+		 * @return true if the entry was found and has not yet expired.
+		 */
+		bool lookup(const AddressBook::EntryId& id, AddressBook::FieldList& entry)
+			throw ();
+
+		/// Add or replace an entry.
+		void store(const AddressBook::EntryId& id,
+			const AddressBook::FieldList& entry)
+			throw ();
+
+		/// Remove an entry, e.g. because it has been changed.
+		void invalidate(const AddressBook::EntryId& id)
+			throw ();
+
+		/// Remove every entry.
+		void clear()
+			throw ();
+
+		/// Change the size and TTL, dropping entries if it is now too big.
+		void setLimits(unsigned int maxEntries, int ttl)
+			throw ();
+
+		/// Get the hit and miss counts.
+		AddressBook::CacheStats getStats() const
+			throw ();
+
+	protected:
+		/// Entry IDs, most recently used first.
+		typedef std::list<AddressBook::EntryId> LS_ENTRYID;
+
+		struct Item {
+			AddressBook::FieldList entry;
+			time_t expires;           ///< When the entry must be fetched again
+			LS_ENTRYID::iterator lru; ///< Position in recent
+		};
+		typedef std::map<AddressBook::EntryId, Item> MP_ITEM;
+
+		/// Protects everything below.
+		mutable boost::mutex lock;
+
+		unsigned int maxEntries;
+		int ttl;
+		MP_ITEM items;
+		LS_ENTRYID recent;
+		AddressBook::CacheStats stats;
+
+		/// Drop the least recently used entries until there are at most max.
+		void trim(unsigned int max)
+			throw ();
+
+		/// Drop an entry.
+		void erase(MP_ITEM::iterator i)
+			throw ();
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_ENTRYCACHE_HPP_
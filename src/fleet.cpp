@@ -0,0 +1,158 @@
+/**
+ * @file   fleet.cpp
+ * @brief  FleetManager class, used to run the same operation across many
+ *         devices at once.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <libmfd/fleet.hpp>
+
+namespace mfd {
+
+/// Work shared between all the threads of a single FleetManager::run() call.
+struct FleetQueue {
+	const VC_HOSTNAME *hosts;
+	const FleetJob *job;
+	VC_FLEETRESULT *results;
+
+	/// Index of the next host to be claimed by a worker.
+	unsigned int next;
+
+	/// Protects next.
+	boost::mutex lock;
+};
+
+FleetManager::FleetManager(ManagerPtr manager, int threads)
+	throw () :
+		manager(manager),
+		threads(threads)
+{
+	if (this->threads < 1) this->threads = 1;
+}
+
+FleetManager::~FleetManager()
+	throw ()
+{
+}
+
+void FleetManager::run(const VC_HOSTNAME& hosts, const FleetJob& job,
+	VC_FLEETRESULT& results
+)
+	throw ()
+{
+	results.clear();
+	results.resize(hosts.size());
+
+	FleetQueue queue;
+	queue.hosts = &hosts;
+	queue.job = &job;
+	queue.results = &results;
+	queue.next = 0;
+
+	// Each worker claims the next unprocessed host until there are none left,
+	// so a slow or dead device only ties up one thread.
+	unsigned int numThreads = this->threads;
+	if (numThreads > hosts.size()) numThreads = hosts.size();
+	boost::thread_group workers;
+	unsigned int started = 0;
+	try {
+		for (; started < numThreads; started++) {
+			workers.create_thread(boost::bind(&FleetManager::worker, this, &queue));
+		}
+	} catch (const boost::thread_resource_error& e) {
+		// Out of threads, so make do with the ones we have
+	}
+	// If none could be started, do all the work on this thread instead
+	if (started == 0) this->worker(&queue);
+	workers.join_all();
+	return;
+}
+
+void FleetManager::worker(FleetQueue *queue)
+	throw ()
+{
+	for (;;) {
+		unsigned int i;
+		{
+			boost::mutex::scoped_lock l(queue->lock);
+			if (queue->next >= queue->hosts->size()) break;
+			i = queue->next++;
+		}
+		// Each thread writes to a different element, so no locking is needed
+		this->runHost((*queue->hosts)[i], *queue->job, (*queue->results)[i]);
+	}
+	return;
+}
+
+void FleetManager::runHost(const std::string& hostname, const FleetJob& job,
+	FleetResult& result
+)
+	throw ()
+{
+	result.hostname = hostname;
+	result.success = false;
+	try {
+		DevicePtr device = this->openDevice(hostname, job);
+		AddressBookPtr ab = device->getAddressBook();
+		if (!ab) throw ECommFailure("This device type does not have an address book.");
+
+		switch (job.operation) {
+			case FleetList:
+				ab->getAllEntries(AddressBook::VC_FIELD(), result.entries);
+				break;
+			case FleetGet:
+				result.entries.push_back(AddressBook::Record(ab->getEntry(job.id)));
+				break;
+			case FleetSet:
+				ab->setEntry(job.id, job.fields);
+				break;
+			case FleetCreate:
+				result.id = ab->createEntry(job.fields);
+				break;
+		}
+		result.success = true;
+	} catch (const std::exception& e) {
+		result.error = e.what();
+	}
+	return;
+}
+
+DevicePtr FleetManager::openDevice(const std::string& hostname,
+	const FleetJob& job
+)
+	throw (ECommFailure)
+{
+	DeviceTypePtr pDeviceType;
+	if (job.deviceCode.empty()) {
+		DeviceProbePtr pProbe;
+		pDeviceType = this->manager->detect(hostname, DETECT_TIMEOUT, &pProbe);
+		if (!pDeviceType) {
+			throw ECommFailure("Unable to automatically determine the device type.");
+		}
+		if (pProbe) return pDeviceType->open(pProbe, job.username, job.password);
+	} else {
+		pDeviceType = this->manager->getDeviceTypeByCode(job.deviceCode);
+		if (!pDeviceType) {
+			throw ECommFailure("Unknown device type: " + job.deviceCode);
+		}
+	}
+	return pDeviceType->open(hostname, job.username, job.password);
+}
+
+} // namespace mfd
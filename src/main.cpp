@@ -19,6 +19,8 @@
  */
 
 #include <string>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <libmfd/manager.hpp>
 #include <libmfd/devicetype.hpp>
 
@@ -28,6 +30,67 @@
 
 namespace mfd {
 
+/// Progress of a Manager::detect() call, shared with each probe thread.
+/**
+ * The probe threads are detached rather than joined, so this must outlive
+ * the detect() call in case a probe is still waiting on the network.
+ */
+struct DetectState {
+	/// Protects the remaining fields.
+	boost::mutex lock;
+
+	/// Signalled whenever a probe finishes.
+	boost::condition_variable probeDone;
+
+	/// First device type to return EC_DEFINITELY_YES.
+	DeviceTypePtr match;
+
+	/// Probe result from the matching device type.
+	DeviceProbePtr matchProbe;
+
+	/// Number of probes still running.
+	int pending;
+};
+
+typedef boost::shared_ptr<DetectState> DetectStatePtr;
+
+/// Thread entry point to probe a host for a single device type.
+static void detectProbe(DetectStatePtr state, DeviceTypePtr type,
+	std::string hostname, int timeout)
+{
+	DeviceProbePtr probe;
+	try {
+		probe = type->probe(hostname, timeout);
+	} catch (const std::exception& e) {
+		// Treat any failure as a non-match
+	}
+
+	boost::mutex::scoped_lock l(state->lock);
+	if (
+		(probe) &&
+		(probe->certainty == EC_DEFINITELY_YES) &&
+		(!state->match)
+	) {
+		state->match = type;
+		state->matchProbe = probe;
+	}
+	state->pending--;
+	state->probeDone.notify_all();
+	return;
+}
+
+DeviceProbe::DeviceProbe(const std::string& hostname, E_CERTAINTY certainty)
+	throw () :
+		hostname(hostname),
+		certainty(certainty)
+{
+}
+
+DeviceProbe::~DeviceProbe()
+	throw ()
+{
+}
+
 ManagerPtr getManager()
 	throw ()
 {
@@ -62,4 +125,71 @@ DeviceTypePtr Manager::getDeviceTypeByCode(const std::string& strCode)
 	return DeviceTypePtr();
 }
 
+void Manager::setCache(DeviceCachePtr cache)
+	throw ()
+{
+	this->cache = cache;
+	return;
+}
+
+DeviceTypePtr Manager::detect(const std::string& hostname, int timeout,
+	DeviceProbePtr *probe, bool refresh
+)
+	throw ()
+{
+	if ((this->cache) && (!refresh)) {
+		DeviceCache::Entry entry;
+		if (this->cache->lookup(hostname, entry)) {
+			DeviceTypePtr type = this->getDeviceTypeByCode(entry.deviceCode);
+			if (type) {
+				if (probe) {
+					probe->reset(new DeviceProbe(hostname, EC_DEFINITELY_YES));
+					(*probe)->details = entry.details;
+					(*probe)->versionInfo = entry.versionInfo;
+				}
+				return type;
+			}
+			// else the device type is no longer supported, so probe again
+		}
+	}
+
+	DetectStatePtr state(new DetectState());
+	state->pending = this->vcTypes.size();
+
+	for (VC_DEVICETYPE::const_iterator i = this->vcTypes.begin(); i != this->vcTypes.end(); i++) {
+		try {
+			boost::thread probe(boost::bind(detectProbe, state, *i, hostname, timeout));
+			probe.detach();
+		} catch (const boost::thread_resource_error& e) {
+			// Out of threads, so probe this type here instead
+			detectProbe(state, *i, hostname, timeout);
+		}
+	}
+
+	boost::system_time deadline = boost::get_system_time()
+		+ boost::posix_time::seconds(timeout);
+	boost::mutex::scoped_lock l(state->lock);
+	while ((!state->match) && (state->pending > 0)) {
+		// Any probes still running when we give up will finish on their own once
+		// their network timeout expires.
+		if (!state->probeDone.timed_wait(l, deadline)) break;
+	}
+	// Take a copy of the result and unlock before writing to the cache, so
+	// probes finishing now don't have to wait for the disk.
+	DeviceTypePtr match = state->match;
+	DeviceProbePtr matchProbe = state->matchProbe;
+	l.unlock();
+
+	if ((this->cache) && (match)) {
+		DeviceCache::Entry entry;
+		entry.deviceCode = match->getDeviceCode();
+		entry.updated = time(NULL);
+		entry.details = matchProbe->details;
+		entry.versionInfo = matchProbe->versionInfo;
+		this->cache->store(hostname, entry);
+	}
+	if (probe) *probe = matchProbe;
+	return match;
+}
+
 } // namespace mfd
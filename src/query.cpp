@@ -0,0 +1,95 @@
+/**
+ * @file   query.cpp
+ * @brief  Query class, used to search an address book on the device.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libmfd/query.hpp>
+
+namespace mfd {
+
+Query::Query()
+	throw () :
+		maxResults(0)
+{
+}
+
+Query& Query::where(AddressBook::Field field, Operator op,
+	const std::string& value
+)
+	throw ()
+{
+	Term t;
+	t.field = field;
+	t.op = op;
+	t.value = value;
+	this->allOf.push_back(t);
+	return *this;
+}
+
+Query& Query::whereBetween(AddressBook::Field field, const std::string& low,
+	const std::string& high
+)
+	throw ()
+{
+	Term t;
+	t.field = field;
+	t.op = Between;
+	t.value = low;
+	t.value2 = high;
+	this->allOf.push_back(t);
+	return *this;
+}
+
+Query& Query::orWhere(AddressBook::Field field, Operator op,
+	const std::string& value
+)
+	throw ()
+{
+	Term t;
+	t.field = field;
+	t.op = op;
+	t.value = value;
+	this->anyOf.push_back(t);
+	return *this;
+}
+
+Query& Query::orderBy(AddressBook::Field field, bool descending)
+	throw ()
+{
+	Order o;
+	o.field = field;
+	o.descending = descending;
+	this->sortOrder.push_back(o);
+	return *this;
+}
+
+Query& Query::select(AddressBook::Field field)
+	throw ()
+{
+	this->fields.push_back(field);
+	return *this;
+}
+
+Query& Query::limit(unsigned int count)
+	throw ()
+{
+	this->maxResults = count;
+	return *this;
+}
+
+} // namespace mfd
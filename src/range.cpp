@@ -0,0 +1,131 @@
+/**
+ * @file   range.cpp
+ * @brief  EntryRange class, for iterating through an address book lazily.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libmfd/range.hpp>
+
+namespace mfd {
+
+EntryRange::iterator::iterator()
+	throw () :
+		range(NULL)
+{
+}
+
+EntryRange::iterator::iterator(EntryRange *range)
+	throw () :
+		range(range)
+{
+}
+
+const AddressBook::EntryId& EntryRange::iterator::id() const
+	throw ()
+{
+	return this->range->ids[this->range->pos];
+}
+
+const AddressBook::Record& EntryRange::iterator::operator * () const
+	throw ()
+{
+	return this->range->page[this->range->pos];
+}
+
+const AddressBook::Record *EntryRange::iterator::operator -> () const
+	throw ()
+{
+	return &this->range->page[this->range->pos];
+}
+
+EntryRange::iterator& EntryRange::iterator::operator ++ ()
+	throw (ECommFailure)
+{
+	if (!this->range->advance()) this->range = NULL;
+	return *this;
+}
+
+void EntryRange::iterator::operator ++ (int)
+	throw (ECommFailure)
+{
+	++(*this);
+	return;
+}
+
+bool EntryRange::iterator::operator == (const iterator& other) const
+	throw ()
+{
+	return this->range == other.range;
+}
+
+bool EntryRange::iterator::operator != (const iterator& other) const
+	throw ()
+{
+	return this->range != other.range;
+}
+
+EntryRange::EntryRange(AddressBookPtr ab, const AddressBook::VC_FIELD& fields)
+	throw () :
+		ab(ab),
+		fields(fields),
+		pos(0),
+		started(false)
+{
+}
+
+EntryRange::iterator EntryRange::begin()
+	throw (ECommFailure)
+{
+	if (!this->started) {
+		this->started = true;
+		if (!this->fetch()) return iterator();
+	} else if (this->pos >= this->page.size()) {
+		return iterator();
+	}
+	return iterator(this);
+}
+
+EntryRange::iterator EntryRange::end()
+	throw ()
+{
+	return iterator();
+}
+
+bool EntryRange::advance()
+	throw (ECommFailure)
+{
+	this->pos++;
+	if (this->pos < this->page.size()) return true;
+	return this->fetch();
+}
+
+bool EntryRange::fetch()
+	throw (ECommFailure)
+{
+	this->pos = 0;
+	do {
+		if (this->cursor.finished) {
+			this->page.clear();
+			this->ids.clear();
+			return false;
+		}
+		this->ab->scanEntries(this->cursor, this->fields, this->ids, this->page);
+	} while (this->page.empty());
+	return true;
+}
+
+} // namespace mfd
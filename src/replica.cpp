@@ -0,0 +1,291 @@
+/**
+ * @file   replica.cpp
+ * @brief  Replica class, keeping a copy of an address book in memory.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <libmfd/replica.hpp>
+
+namespace mfd {
+
+/// Default number of seconds between full reloads, the only way edits are seen
+#define RELOAD_INTERVAL  300
+
+Replica::Replica(AddressBookPtr ab, const AddressBook::VC_FIELD& fields)
+	throw () :
+		ab(ab),
+		fields(fields),
+		lastRefresh(0),
+		lastLoad(0),
+		reloadInterval(RELOAD_INTERVAL),
+		stopping(false)
+{
+	if (
+		(!this->fields.empty()) &&
+		(std::find(this->fields.begin(), this->fields.end(), AddressBook::Index)
+			== this->fields.end())
+	) {
+		this->fields.push_back(AddressBook::Index);
+	}
+}
+
+Replica::~Replica()
+	throw ()
+{
+	this->stopRefresh();
+}
+
+void Replica::load()
+	throw (ECommFailure)
+{
+	boost::mutex::scoped_lock lock(this->refreshLock);
+	this->loadLocked();
+	return;
+}
+
+void Replica::refresh()
+	throw (ECommFailure)
+{
+	boost::mutex::scoped_lock lock(this->refreshLock);
+	time_t now = time(NULL);
+	if (
+		(this->lastLoad == 0) ||
+		((this->reloadInterval > 0) && (now - this->lastLoad >= this->reloadInterval))
+	) {
+		this->loadLocked();
+	} else {
+		this->updateLocked();
+	}
+	return;
+}
+
+bool Replica::refreshIfOlder(int maxAge)
+	throw (ECommFailure)
+{
+	if (time(NULL) - this->getLastRefresh() < maxAge) return false;
+	this->refresh();
+	return true;
+}
+
+void Replica::setReloadInterval(int interval)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->refreshLock);
+	this->reloadInterval = interval;
+	return;
+}
+
+void Replica::startRefresh(int interval)
+	throw ()
+{
+	this->stopRefresh();
+	this->stopping = false;
+	try {
+		this->refresher.reset(new boost::thread(
+			boost::bind(&Replica::refreshThread, this, interval)));
+	} catch (const boost::thread_resource_error& e) {
+		boost::unique_lock<boost::shared_mutex> lock(this->dataLock);
+		this->lastError = std::string("Unable to start the refresh thread: ")
+			+ e.what();
+	}
+	return;
+}
+
+void Replica::stopRefresh()
+	throw ()
+{
+	if (!this->refresher) return;
+	{
+		boost::mutex::scoped_lock lock(this->stopLock);
+		this->stopping = true;
+	}
+	this->stopSignal.notify_all();
+	this->refresher->join();
+	this->refresher.reset();
+	return;
+}
+
+bool Replica::get(const AddressBook::EntryId& id,
+	AddressBook::Record& entry
+) const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	MP_ENTRY::const_iterator i = this->entries.find(id);
+	if (i == this->entries.end()) return false;
+	entry = i->second;
+	return true;
+}
+
+void Replica::getEntryIds(AddressBook::VC_ENTRYID& ids) const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	ids.reserve(ids.size() + this->entries.size());
+	for (MP_ENTRY::const_iterator i = this->entries.begin(); i != this->entries.end(); i++) {
+		ids.push_back(i->first);
+	}
+	return;
+}
+
+bool Replica::visit(AddressBook::FN_VISIT visit) const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	for (MP_ENTRY::const_iterator i = this->entries.begin(); i != this->entries.end(); i++) {
+		if (!visit(i->first, i->second)) return false;
+	}
+	return true;
+}
+
+unsigned int Replica::size() const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	return this->entries.size();
+}
+
+time_t Replica::getLastRefresh() const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	return this->lastRefresh;
+}
+
+std::string Replica::getLastError() const
+	throw ()
+{
+	boost::shared_lock<boost::shared_mutex> lock(this->dataLock);
+	return this->lastError;
+}
+
+void Replica::loadLocked()
+	throw (ECommFailure)
+{
+	// Build the new copy without holding dataLock, so reads can carry on
+	// from the old copy in the meantime.
+	MP_ENTRY newEntries;
+	this->ab->visitAllEntries(this->fields,
+		boost::bind(&Replica::storeEntry, &newEntries, _1, _2));
+	MP_INDEX newIndexes;
+	for (MP_ENTRY::iterator i = newEntries.begin(); i != newEntries.end(); i++) {
+		newIndexes[i->first] = indexOf(i->second);
+	}
+
+	time_t now = time(NULL);
+	boost::unique_lock<boost::shared_mutex> lock(this->dataLock);
+	this->entries.swap(newEntries);
+	this->indexes.swap(newIndexes);
+	this->lastRefresh = now;
+	this->lastLoad = now;
+	this->lastError.clear();
+	return;
+}
+
+void Replica::updateLocked()
+	throw (ECommFailure)
+{
+	// List the ID and index of every entry.  This is much smaller than the
+	// entries themselves.
+	MP_ENTRY current;
+	this->ab->visitAllEntries(AddressBook::VC_FIELD(1, AddressBook::Index),
+		boost::bind(&Replica::storeEntry, &current, _1, _2));
+
+	// Only this thread changes indexes, so it can be read without dataLock.
+	AddressBook::VC_ENTRYID changed;
+	MP_INDEX newIndexes;
+	for (MP_ENTRY::iterator i = current.begin(); i != current.end(); i++) {
+		std::string index = indexOf(i->second);
+		newIndexes[i->first] = index;
+		MP_INDEX::iterator old = this->indexes.find(i->first);
+		if ((old == this->indexes.end()) || (old->second.compare(index) != 0)) {
+			changed.push_back(i->first);
+		}
+	}
+
+	MP_ENTRY updated;
+	if (!changed.empty()) {
+		this->ab->visitEntries(changed, this->fields,
+			boost::bind(&Replica::storeEntry, &updated, _1, _2));
+
+		// Anything the device didn't return is tried again next time
+		for (AddressBook::VC_ENTRYID::iterator i = changed.begin(); i != changed.end(); i++) {
+			if (updated.find(*i) != updated.end()) continue;
+			MP_INDEX::iterator old = this->indexes.find(*i);
+			if (old != this->indexes.end()) newIndexes[*i] = old->second;
+			else newIndexes.erase(*i);
+		}
+	}
+
+	time_t now = time(NULL);
+	boost::unique_lock<boost::shared_mutex> lock(this->dataLock);
+	// Drop entries that have been deleted from the device
+	for (MP_ENTRY::iterator i = this->entries.begin(); i != this->entries.end(); ) {
+		if (newIndexes.find(i->first) == newIndexes.end()) this->entries.erase(i++);
+		else i++;
+	}
+	for (MP_ENTRY::iterator i = updated.begin(); i != updated.end(); i++) {
+		this->entries[i->first] = i->second;
+	}
+	this->indexes.swap(newIndexes);
+	this->lastRefresh = now;
+	this->lastError.clear();
+	return;
+}
+
+void Replica::refreshThread(int interval)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->stopLock);
+	while (!this->stopping) {
+		lock.unlock();
+		try {
+			this->refresh();
+		} catch (const ECommFailure& e) {
+			boost::unique_lock<boost::shared_mutex> dataLock(this->dataLock);
+			this->lastError = e.what();
+		}
+		lock.lock();
+
+		boost::system_time until = boost::get_system_time()
+			+ boost::posix_time::seconds(interval);
+		while ((!this->stopping) && (this->stopSignal.timed_wait(lock, until))) {
+			// Woken without being stopped, go back to sleep
+		}
+	}
+	return;
+}
+
+bool Replica::storeEntry(MP_ENTRY *entries, const AddressBook::EntryId& id,
+	const AddressBook::Record& entry
+)
+	throw ()
+{
+	(*entries)[id] = entry;
+	return true;
+}
+
+std::string Replica::indexOf(const AddressBook::Record& entry)
+	throw ()
+{
+	return entry.get(AddressBook::Index);
+}
+
+} // namespace mfd
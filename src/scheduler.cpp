@@ -0,0 +1,253 @@
+/**
+ * @file   scheduler.cpp
+ * @brief  WriteScheduler class, for writing entries with the address book
+ *         locked for as little time as possible.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <libmfd/scheduler.hpp>
+
+namespace mfd {
+
+WriteScheduler::WriteScheduler(AddressBookPtr ab)
+	throw () :
+		ab(ab),
+		maxEntries(0),
+		maxDelay(0),
+		stopping(false),
+		retrying(false)
+{
+}
+
+WriteScheduler::~WriteScheduler()
+	throw ()
+{
+	this->stopWriteBehind();
+}
+
+void WriteScheduler::add(const AddressBook::EntryId& id,
+	const AddressBook::FieldList& update
+)
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->queueLock);
+	bool first = this->pending.empty();
+	if (first) this->firstQueued = boost::get_system_time();
+	AddressBook::FieldList& fields = this->pending[id];
+	for (AddressBook::FieldList::const_iterator i = update.begin(); i != update.end(); i++) {
+		fields[i->first] = i->second;
+	}
+	// Wake the background thread to start its timer, or to flush
+	if (
+		(first) ||
+		((this->maxEntries) && (this->pending.size() >= this->maxEntries))
+	) {
+		this->wake.notify_all();
+	}
+	return;
+}
+
+unsigned int WriteScheduler::size() const
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->queueLock);
+	return this->pending.size();
+}
+
+void WriteScheduler::flush(AddressBook::BatchStats& stats)
+	throw (ECommFailure)
+{
+	boost::mutex::scoped_lock flushing(this->flushLock);
+
+	// Take everything queued so far, so more can be queued during the write
+	AddressBook::MP_UPDATE batch;
+	{
+		boost::mutex::scoped_lock lock(this->queueLock);
+		batch.swap(this->pending);
+	}
+	if (batch.empty()) return;
+
+	try {
+		this->write(batch, stats);
+	} catch (const ECommFailure& e) {
+		// Put the changes back, behind anything newer queued in the meantime
+		boost::mutex::scoped_lock lock(this->queueLock);
+		this->firstQueued = boost::get_system_time();
+		this->retrying = true;
+		for (AddressBook::MP_UPDATE::iterator i = batch.begin(); i != batch.end(); i++) {
+			this->pending[i->first].insert(i->second.begin(), i->second.end());
+		}
+		throw;
+	}
+	boost::mutex::scoped_lock lock(this->queueLock);
+	this->retrying = false;
+	return;
+}
+
+void WriteScheduler::startWriteBehind(unsigned int maxEntries, int maxDelay)
+	throw ()
+{
+	this->stopWriteBehind();
+	{
+		boost::mutex::scoped_lock lock(this->queueLock);
+		this->maxEntries = maxEntries;
+		this->maxDelay = maxDelay;
+		this->stopping = false;
+	}
+	try {
+		this->writer.reset(new boost::thread(
+			boost::bind(&WriteScheduler::writeThread, this)));
+	} catch (const boost::thread_resource_error& e) {
+		boost::mutex::scoped_lock lock(this->queueLock);
+		this->lastError = std::string("Unable to start the write-behind "
+			"thread: ") + e.what();
+	}
+	return;
+}
+
+void WriteScheduler::stopWriteBehind()
+	throw ()
+{
+	if (!this->writer) return;
+	{
+		boost::mutex::scoped_lock lock(this->queueLock);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	this->writer->join();
+	this->writer.reset();
+	return;
+}
+
+AddressBook::BatchStats WriteScheduler::getLastStats() const
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->queueLock);
+	return this->lastStats;
+}
+
+std::string WriteScheduler::getLastError() const
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->queueLock);
+	return this->lastError;
+}
+
+void WriteScheduler::write(const AddressBook::MP_UPDATE& batch,
+	AddressBook::BatchStats& stats
+)
+	throw (ECommFailure)
+{
+	// Read back only the fields being changed
+	AddressBook::VC_ENTRYID ids;
+	AddressBook::VC_FIELD fields;
+	ids.reserve(batch.size());
+	for (AddressBook::MP_UPDATE::const_iterator i = batch.begin(); i != batch.end(); i++) {
+		ids.push_back(i->first);
+		for (AddressBook::FieldList::const_iterator f = i->second.begin(); f != i->second.end(); f++) {
+			if (std::find(fields.begin(), fields.end(), f->first) == fields.end()) {
+				fields.push_back(f->first);
+			}
+		}
+	}
+
+	// Entries are moved across to updates as they are found, so anything left
+	// in remaining no longer exists on the device.
+	AddressBook::MP_UPDATE remaining(batch);
+	AddressBook::MP_UPDATE updates;
+	this->ab->visitEntries(ids, fields,
+		boost::bind(&WriteScheduler::takeChanged, &remaining, &updates, _1, _2));
+	stats.missing += remaining.size();
+	stats.skipped += batch.size() - remaining.size() - updates.size();
+
+	this->ab->applyBatch(updates, stats);
+	return;
+}
+
+void WriteScheduler::writeThread()
+	throw ()
+{
+	boost::mutex::scoped_lock lock(this->queueLock);
+	while (!this->stopping) {
+		if (this->pending.empty()) {
+			this->wake.wait(lock);
+			continue;
+		}
+		// After a failure, wait out the delay even if there is enough to write,
+		// so a device that is down isn't tried again straight away.
+		boost::system_time due = this->firstQueued
+			+ boost::posix_time::seconds(this->maxDelay);
+		if (
+			(
+				(this->retrying) ||
+				(this->maxEntries == 0) ||
+				(this->pending.size() < this->maxEntries)
+			) && (boost::get_system_time() < due)
+		) {
+			this->wake.timed_wait(lock, due);
+			continue;
+		}
+		lock.unlock();
+		this->backgroundFlush();
+		lock.lock();
+	}
+
+	// Don't lose anything still waiting
+	bool left = !this->pending.empty();
+	lock.unlock();
+	if (left) this->backgroundFlush();
+	return;
+}
+
+void WriteScheduler::backgroundFlush()
+	throw ()
+{
+	AddressBook::BatchStats stats;
+	try {
+		this->flush(stats);
+	} catch (const ECommFailure& e) {
+		boost::mutex::scoped_lock lock(this->queueLock);
+		this->lastError = e.what();
+		return;
+	}
+	boost::mutex::scoped_lock lock(this->queueLock);
+	this->lastStats = stats;
+	this->lastError.clear();
+	return;
+}
+
+bool WriteScheduler::takeChanged(AddressBook::MP_UPDATE *remaining,
+	AddressBook::MP_UPDATE *updates, const AddressBook::EntryId& id,
+	const AddressBook::Record& entry
+)
+	throw ()
+{
+	AddressBook::MP_UPDATE::iterator u = remaining->find(id);
+	if (u == remaining->end()) return true;
+	AddressBook::FieldList changed;
+	for (AddressBook::FieldList::iterator i = u->second.begin(); i != u->second.end(); i++) {
+		if (entry.get(i->first).compare(i->second) != 0) changed[i->first] = i->second;
+	}
+	if (!changed.empty()) (*updates)[id].swap(changed);
+	remaining->erase(u);
+	return true;
+}
+
+} // namespace mfd
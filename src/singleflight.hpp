@@ -0,0 +1,125 @@
+/**
+ * @file   singleflight.hpp
+ * @brief  SingleFlight class, for sharing one request between callers
+ *         asking for the same thing at the same time.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMFD_SINGLEFLIGHT_HPP_
+#define _LIBMFD_SINGLEFLIGHT_HPP_
+
+#include <map>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <libmfd/exceptions.hpp>
+
+namespace mfd {
+
+/// Make sure only one request for each key is in progress at once.
+/**
+ * The first thread to ask for a key makes the request.  Any other thread
+ * asking for the same key before it finishes waits for it instead of making
+ * its own request, then gets a copy of the same result, or the same error.
+ *
+ * Nothing is kept once the request finishes, so this is not a cache.  It
+ * only stops a burst of identical requests, such as when a cached value
+ * expires, from all reaching the device.
+ */
+template <typename Key, typename Value>
+class SingleFlight {
+
+	public:
+		/// Function making the real request.
+		typedef boost::function<Value ()> FN_FETCH;
+
+		/// Get the value for key, sharing any request already in progress.
+		/**
+		 * @param  key    Identifies the request.
+		 * @param  fetch  Called to make the request, unless another thread is
+		 *   already making it.
+		 */
+		Value run(const Key& key, FN_FETCH fetch)
+			throw (ECommFailure)
+		{
+			boost::mutex::scoped_lock lock(this->lock);
+			typename MP_CALL::iterator i = this->calls.find(key);
+			if (i != this->calls.end()) {
+				// Someone else is already asking, wait for their answer
+				CallPtr call = i->second;
+				while (!call->finished) this->done.wait(lock);
+				if (call->failed) throw ECommFailure(call->error);
+				return call->value;
+			}
+
+			CallPtr call(new Call);
+			this->calls[key] = call;
+			lock.unlock();
+			try {
+				call->value = fetch();
+			} catch (const ECommFailure& e) {
+				call->failed = true;
+				call->error = e.what();
+			} catch (...) {
+				// The waiters must still be woken, and only ECommFailure can be
+				// passed on to them or thrown from here.
+				call->failed = true;
+				call->error = "Unexpected error while making the request";
+			}
+			lock.lock();
+			call->finished = true;
+			this->calls.erase(key);
+			this->done.notify_all();
+			if (call->failed) throw ECommFailure(call->error);
+			return call->value;
+		}
+
+	protected:
+		/// A request in progress.
+		struct Call {
+			Value value;
+			std::string error;  ///< Reason for failure, if failed is true
+			bool failed;
+			bool finished;
+
+			Call()
+				throw () :
+					failed(false),
+					finished(false)
+			{
+			}
+		};
+		typedef boost::shared_ptr<Call> CallPtr;
+		typedef std::map<Key, CallPtr> MP_CALL;
+
+		/// Protects calls.
+		boost::mutex lock;
+
+		/// Signalled whenever a request finishes.
+		boost::condition_variable done;
+
+		/// Requests in progress.
+		MP_CALL calls;
+
+};
+
+} // namespace mfd
+
+#endif // _LIBMFD_SINGLEFLIGHT_HPP_
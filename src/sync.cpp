@@ -0,0 +1,151 @@
+/**
+ * @file   sync.cpp
+ * @brief  Sync class, bringing an address book into line with a list of
+ *         entries.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <libmfd/sync.hpp>
+
+namespace mfd {
+
+/// State shared between Sync::plan() and compareEntry().
+struct SyncState {
+	/// Key value of each desired entry, and its position in the list.
+	typedef std::map<std::string, unsigned int> MP_KEY;
+
+	const AddressBook::VC_FIELDLIST *desired;
+	AddressBook::Field key;
+	bool deleteUnmatched;
+	MP_KEY keys;
+	std::vector<bool> matched;  ///< Has each desired entry been found yet?
+	SyncPlan *plan;
+};
+
+/// FN_VISIT callback that compares a current entry with the desired one.
+bool compareEntry(SyncState *state, const AddressBook::EntryId& id,
+	const AddressBook::Record& entry)
+	throw ()
+{
+	SyncState::MP_KEY::iterator k = state->keys.end();
+	if (entry.has(state->key)) k = state->keys.find(entry.get(state->key));
+
+	// Entries that aren't wanted, including extra ones with the same key
+	if ((k == state->keys.end()) || (state->matched[k->second])) {
+		if (state->deleteUnmatched) state->plan->deletes.push_back(id);
+		return true;
+	}
+	state->matched[k->second] = true;
+
+	const AddressBook::FieldList& want = (*state->desired)[k->second];
+	AddressBook::FieldList changes;
+	for (AddressBook::FieldList::const_iterator i = want.begin(); i != want.end(); i++) {
+		if (entry.get(i->first).compare(i->second) != 0) {
+			changes[i->first] = i->second;
+		}
+	}
+	if (changes.empty()) state->plan->unchanged++;
+	else state->plan->updates[id].swap(changes);
+	return true;
+}
+
+SyncPlan::SyncPlan()
+	throw () :
+		unchanged(0)
+{
+}
+
+bool SyncPlan::empty() const
+	throw ()
+{
+	return this->creates.empty() && this->updates.empty()
+		&& this->deletes.empty();
+}
+
+Sync::Sync(AddressBookPtr ab, AddressBook::Field key)
+	throw () :
+		ab(ab),
+		key(key),
+		deleteUnmatched(false)
+{
+}
+
+void Sync::setDeleteUnmatched(bool remove)
+	throw ()
+{
+	this->deleteUnmatched = remove;
+	return;
+}
+
+void Sync::plan(const AddressBook::VC_FIELDLIST& desired, SyncPlan& plan)
+	throw (ECommFailure, std::invalid_argument)
+{
+	SyncState state;
+	state.desired = &desired;
+	state.key = this->key;
+	state.deleteUnmatched = this->deleteUnmatched;
+	state.matched.resize(desired.size(), false);
+	state.plan = &plan;
+
+	// Only retrieve the key and the fields we might have to change
+	AddressBook::VC_FIELD fields(1, this->key);
+	for (unsigned int i = 0; i < desired.size(); i++) {
+		AddressBook::FieldList::const_iterator k = desired[i].find(this->key);
+		if ((k == desired[i].end()) || (k->second.empty())) {
+			throw std::invalid_argument("Desired entry has no value for the key field");
+		}
+		if (!state.keys.insert(SyncState::MP_KEY::value_type(k->second, i)).second) {
+			throw std::invalid_argument("Two desired entries have the same key: "
+				+ k->second);
+		}
+		for (AddressBook::FieldList::const_iterator f = desired[i].begin(); f != desired[i].end(); f++) {
+			if (std::find(fields.begin(), fields.end(), f->first) == fields.end()) {
+				fields.push_back(f->first);
+			}
+		}
+	}
+
+	this->ab->visitAllEntries(fields, boost::bind(compareEntry, &state, _1, _2));
+
+	for (unsigned int i = 0; i < desired.size(); i++) {
+		if (!state.matched[i]) plan.creates.push_back(desired[i]);
+	}
+	return;
+}
+
+void Sync::apply(const SyncPlan& plan)
+	throw (ECommFailure)
+{
+	// All in one go, so the address book is only locked for writing once
+	AddressBook::VC_ENTRYID ids;
+	AddressBook::BatchStats stats;
+	this->ab->applyChanges(plan.deletes, plan.updates, plan.creates, ids,
+		stats);
+	return;
+}
+
+void Sync::run(const AddressBook::VC_FIELDLIST& desired, SyncPlan& plan)
+	throw (ECommFailure, std::invalid_argument)
+{
+	this->plan(desired, plan);
+	this->apply(plan);
+	return;
+}
+
+} // namespace mfd
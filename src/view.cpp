@@ -0,0 +1,57 @@
+/**
+ * @file   view.cpp
+ * @brief  EntryView class, giving access to entries without copying them.
+ *
+ * Copyright (C) 2010 Adam Nielsen <adam.nielsen@uq.edu.au>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libmfd/view.hpp>
+
+namespace mfd {
+
+StringRef::StringRef()
+	throw () :
+		data(""),
+		length(0)
+{
+}
+
+StringRef::StringRef(const std::string& s)
+	throw () :
+		data(s.data()),
+		length(s.length())
+{
+}
+
+std::string StringRef::str() const
+	throw ()
+{
+	return std::string(this->data, this->length);
+}
+
+std::ostream& operator << (std::ostream& s, const StringRef& r)
+	throw ()
+{
+	s.write(r.data, r.length);
+	return s;
+}
+
+EntryView::~EntryView()
+	throw ()
+{
+}
+
+} // namespace mfd